@@ -82,6 +82,41 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
 
 }
 
+/**
+* Removes the oldest entry of @param buffer, copying it to @param entry and advancing buffer->out_offs.
+* The slot is cleared so it no longer contributes to file position lookups.
+* Any necessary locking must be handled by the caller
+* Any memory referenced in the removed entry is now owned by the caller.
+* @return true if an entry was removed, false if @param buffer was empty
+*/
+bool aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *entry)
+{
+    if(!buffer->full && buffer->in_offs == buffer->out_offs){
+        return false;
+    }
+    *entry = buffer->entry[buffer->out_offs];
+    buffer->entry[buffer->out_offs].buffptr = NULL;
+    buffer->entry[buffer->out_offs].size = 0;
+    buffer->out_offs++;
+    if(buffer->out_offs == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED){
+        buffer->out_offs = 0;
+    }
+    buffer->full = false;
+    return true;
+}
+
+/**
+* @return the number of entries currently held in @param buffer
+* Any necessary locking must be handled by the caller
+*/
+uint8_t aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer)
+{
+    if(buffer->full){
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
 */
@@ -0,0 +1,390 @@
+/**
+ * @file aesd-core-bench.c
+ * @brief Randomized userspace exerciser and benchmark for the aesd-core buffer logic
+ *
+ * Drives the same aesd-core code the driver is built from with a random mix of
+ * writes (split at random points, holding any number of newlines), reads at
+ * sequential or random positions through a read cursor, and seekto lookups.
+ * Every result is compared against a simple reference model of the commands
+ * kept under the -e entry and -b byte limits unless -u is given, in which case
+ * only the aesd-core calls are timed.
+ *
+ * Usage: aesd-core-bench [-n ops] [-s seed] [-l max_write_len] [-e max_entries] [-b max_bytes] [-u]
+ *
+ * Runs without the module loaded, so the cost of a change to the buffer logic
+ * can be compared between two trees on any Linux box: make bench && ./aesd-core-bench -u
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "aesd-core.h"
+
+#define READ_CHUNK 4096
+
+struct model
+{
+    char *entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t sizes[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned int first;
+    unsigned int count;
+    size_t size;
+    char *pending;
+    size_t pending_size;
+};
+
+struct bench_config
+{
+    unsigned long ops;
+    unsigned int seed;
+    size_t max_write_len;
+    unsigned int max_entries;
+    size_t max_bytes;
+    bool verify;
+};
+
+struct bench_counters
+{
+    unsigned long writes;
+    unsigned long reads;
+    unsigned long seeks;
+    unsigned long commands;
+    unsigned long evictions;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+};
+
+static uint64_t rng_state;
+
+/**
+ * xorshift64, cheap enough that generating the written bytes does not dominate the run
+ */
+static uint32_t bench_rand(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+static void fail(unsigned long op, const char *what)
+{
+    fprintf(stderr, "Mismatch at operation %lu: %s\n", op, what);
+    exit(1);
+}
+
+static void model_write(struct model *m, const struct bench_config *config, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    const char *newline;
+
+    while ((newline = memchr(buf, '\n', end - buf)) != NULL)
+    {
+        size_t cmd_size = newline + 1 - buf;
+        unsigned int index;
+        char *cmd = malloc(m->pending_size + cmd_size);
+
+        memcpy(cmd, m->pending, m->pending_size);
+        memcpy(&cmd[m->pending_size], buf, cmd_size);
+        cmd_size += m->pending_size;
+        while (m->count && (m->count == config->max_entries ||
+                            (config->max_bytes && m->size + cmd_size > config->max_bytes)))
+        {
+            free(m->entries[m->first]);
+            m->size -= m->sizes[m->first];
+            m->first = (m->first + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+            m->count--;
+        }
+        index = (m->first + m->count) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        m->count++;
+        m->entries[index] = cmd;
+        m->sizes[index] = cmd_size;
+        m->size += cmd_size;
+        free(m->pending);
+        m->pending = NULL;
+        m->pending_size = 0;
+        buf = newline + 1;
+    }
+    if (buf != end)
+    {
+        m->pending = realloc(m->pending, m->pending_size + (end - buf));
+        memcpy(&m->pending[m->pending_size], buf, end - buf);
+        m->pending_size += end - buf;
+    }
+}
+
+/**
+ * Copy up to @param len bytes of the model content starting at @param pos into @param dst
+ * @return the number of bytes copied
+ */
+static size_t model_read(const struct model *m, size_t pos, char *dst, size_t len)
+{
+    size_t copied = 0;
+    unsigned int i;
+
+    for (i = 0; i < m->count && copied < len; i++)
+    {
+        unsigned int index = (m->first + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        size_t n;
+
+        if (pos >= m->sizes[index])
+        {
+            pos -= m->sizes[index];
+            continue;
+        }
+        n = m->sizes[index] - pos;
+        if (n > len - copied)
+        {
+            n = len - copied;
+        }
+        memcpy(&dst[copied], &m->entries[index][pos], n);
+        copied += n;
+        pos = 0;
+    }
+    return copied;
+}
+
+static void model_free(struct model *m)
+{
+    unsigned int i;
+
+    for (i = 0; i < m->count; i++)
+    {
+        free(m->entries[(m->first + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]);
+    }
+    free(m->pending);
+    memset(m, 0, sizeof(*m));
+}
+
+/**
+ * Write @param len random bytes the way aesd_write_iter does, from a heap buffer that
+ * aesd_core_next_command may take over
+ */
+static void bench_write(struct aesd_core *core, struct model *m, const struct bench_config *config,
+                        struct bench_counters *counters, unsigned long op)
+{
+    size_t len = 1 + bench_rand() % config->max_write_len;
+    char *write_buf = malloc(len);
+    const char *start = write_buf;
+    const char *end = write_buf + len;
+    struct aesd_buffer_entry command;
+    struct aesd_buffer_entry evicted;
+    size_t i;
+    int rc;
+
+    if (write_buf == NULL)
+    {
+        fail(op, "out of memory");
+    }
+    for (i = 0; i < len; i++)
+    {
+        write_buf[i] = (bench_rand() % 16 == 0) ? '\n' : 'a' + bench_rand() % 26;
+    }
+    // Terminate most writes so single command hand over is exercised too
+    if (bench_rand() % 2)
+    {
+        write_buf[len - 1] = '\n';
+    }
+    if (config->verify)
+    {
+        model_write(m, config, write_buf, len);
+    }
+
+    while ((rc = aesd_core_next_command(core, &start, end, &write_buf, &command)) > 0)
+    {
+        while (aesd_core_evict(core, command.size, &evicted))
+        {
+            free((void *)evicted.buffptr);
+            counters->evictions++;
+        }
+        aesd_core_commit(core, &command);
+        counters->commands++;
+    }
+    if (rc < 0)
+    {
+        fail(op, "aesd_core_next_command failed");
+    }
+    free(write_buf);
+    counters->writes++;
+    counters->bytes_written += len;
+}
+
+/**
+ * Read up to READ_CHUNK bytes from @param *pos through the read cursor, the way aesd_read_iter does
+ */
+static void bench_read(struct aesd_core *core, struct aesd_read_cursor *cursor, size_t *pos,
+                       const struct model *m, const struct bench_config *config,
+                       struct bench_counters *counters, unsigned long op)
+{
+    static char buf[READ_CHUNK];
+    static char expected[READ_CHUNK];
+    size_t want = 1 + bench_rand() % READ_CHUNK;
+    size_t copied = 0;
+    struct aesd_buffer_entry *entry;
+    size_t offset;
+    size_t n;
+
+    // Evictions move the data to lower positions, like a reader that lseeks past the end
+    if (*pos > core->size)
+    {
+        *pos = core->size;
+    }
+    if (want > core->size - *pos)
+    {
+        want = core->size - *pos;
+    }
+    while (copied < want && (entry = aesd_core_find_entry(core, cursor, *pos, &offset)) != NULL)
+    {
+        n = entry->size - offset;
+        if (n > want - copied)
+        {
+            n = want - copied;
+        }
+        memcpy(&buf[copied], &entry->buffptr[offset], n);
+        copied += n;
+        *pos += n;
+        aesd_core_update_cursor(core, cursor, entry, offset + n, *pos);
+    }
+    if (config->verify)
+    {
+        if (copied != want || core->size != m->size || model_read(m, *pos - copied, expected, want) != want ||
+            memcmp(buf, expected, want) != 0)
+        {
+            fail(op, "read returned the wrong bytes");
+        }
+    }
+    counters->reads++;
+    counters->bytes_read += copied;
+}
+
+static void bench_seekto(struct aesd_core *core, size_t *pos, const struct model *m,
+                         const struct bench_config *config, struct bench_counters *counters,
+                         unsigned long op)
+{
+    uint32_t write_cmd = bench_rand() % (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1);
+    uint32_t write_cmd_offset = bench_rand() % 64;
+    size_t newpos = 0;
+    int rc = aesd_core_cmd_to_fpos(core, write_cmd, write_cmd_offset, &newpos);
+
+    if (config->verify)
+    {
+        size_t expected = 0;
+        bool valid = write_cmd < m->count;
+        uint32_t i;
+
+        for (i = 0; valid && i < write_cmd; i++)
+        {
+            expected += m->sizes[(m->first + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        }
+        valid = valid && write_cmd_offset < m->sizes[(m->first + write_cmd) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        if (valid != (rc == 0) || (valid && newpos != expected + write_cmd_offset))
+        {
+            fail(op, "seekto resolved the wrong position");
+        }
+    }
+    if (rc == 0)
+    {
+        *pos = newpos;
+    }
+    counters->seeks++;
+}
+
+static double elapsed_sec(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_config config = {
+        .ops = 1000000,
+        .seed = 1,
+        .max_write_len = 256,
+        .max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+        .max_bytes = 0,
+        .verify = true,
+    };
+    struct bench_counters counters = {0};
+    struct aesd_core core;
+    struct aesd_read_cursor cursor = {0};
+    struct model m = {0};
+    struct timespec start, end;
+    size_t pos = 0;
+    unsigned long op;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:l:e:b:u")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            config.ops = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            config.seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            config.max_write_len = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            config.max_entries = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            config.max_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            config.verify = false;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n ops] [-s seed] [-l max_write_len] [-e max_entries] [-b max_bytes] [-u]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.max_write_len < 1 || config.max_entries < 1 ||
+        config.max_entries > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    rng_state = 0x9e3779b97f4a7c15ULL ^ config.seed;
+    aesd_core_init(&core);
+    aesd_core_set_limits(&core, config.max_entries, config.max_bytes);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (op = 0; op < config.ops; op++)
+    {
+        int kind = bench_rand() % 8;
+
+        if (kind < 3)
+        {
+            bench_write(&core, &m, &config, &counters, op);
+        }
+        else if (kind < 7)
+        {
+            // Mostly sequential reads, which is the case the read cursor is there for
+            if (kind == 6)
+            {
+                pos = bench_rand() % (core.size + 1);
+            }
+            bench_read(&core, &cursor, &pos, &m, &config, &counters, op);
+        }
+        else
+        {
+            bench_seekto(&core, &pos, &m, &config, &counters, op);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = elapsed_sec(&start, &end);
+    printf("ops=%lu seed=%u max_entries=%u max_bytes=%zu verify=%d secs=%.3f ops/s=%.0f writes=%lu commands=%lu evictions=%lu reads=%lu seeks=%lu write_MB/s=%.1f read_MB/s=%.1f\n",
+           config.ops, config.seed, config.max_entries, config.max_bytes, config.verify, secs, config.ops / secs,
+           counters.writes, counters.commands, counters.evictions, counters.reads, counters.seeks,
+           counters.bytes_written / secs / (1024 * 1024), counters.bytes_read / secs / (1024 * 1024));
+    aesd_core_free(&core);
+    model_free(&m);
+    return 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file aesd-core.c
+ * @brief Buffer logic of the aesd char driver, built into the kernel module and into
+ * user space tests and benchmarks
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#define aesd_core_malloc(size) kmalloc(size, GFP_KERNEL)
+#define aesd_core_realloc(ptr, size) krealloc(ptr, size, GFP_KERNEL)
+#define aesd_core_free_buf(ptr) kfree(ptr)
+#else
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#define aesd_core_malloc(size) malloc(size)
+#define aesd_core_realloc(ptr, size) realloc((void *)(ptr), size)
+#define aesd_core_free_buf(ptr) free((void *)(ptr))
+#endif
+
+#include "aesd-core.h"
+
+/**
+* Initializes @param core to an empty buffer with no partial command, evicting only when all
+* AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries are used
+*/
+void aesd_core_init(struct aesd_core *core)
+{
+    memset(core, 0, sizeof(struct aesd_core));
+    core->max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Sets the eviction limits of @param core, applied from the next commit on
+* @param max_entries is clamped to [1, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]
+* @param max_bytes is the byte budget of the committed entries, 0 for no byte limit
+*/
+void aesd_core_set_limits(struct aesd_core *core, uint8_t max_entries, size_t max_bytes)
+{
+    if(max_entries < 1){
+        max_entries = 1;
+    }
+    if(max_entries > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED){
+        max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    core->max_entries = max_entries;
+    core->max_bytes = max_bytes;
+}
+
+/**
+* Frees every committed entry and the partial command of @param core
+*/
+void aesd_core_free(struct aesd_core *core)
+{
+    uint8_t index;
+    struct aesd_buffer_entry *entry;
+    uint8_t max_entries = core->max_entries;
+    size_t max_bytes = core->max_bytes;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &core->c_buffer, index)
+    {
+        aesd_core_free_buf(entry->buffptr);
+    }
+    aesd_core_free_buf(core->c_buffer_entry.buffptr);
+    aesd_core_init(core);
+    aesd_core_set_limits(core, max_entries, max_bytes);
+}
+
+/**
+* Takes the next newline terminated command out of the written bytes [*start, end), prefixed
+* with the pending partial command.  Only the new bytes are scanned since the partial command
+* never holds a newline.
+* @param write_buf points to the heap buffer holding the written bytes, or to NULL.  When the
+*      buffer is exactly one command and nothing is pending it becomes the command storage
+*      without a copy and *write_buf is set to NULL.
+* @param command is filled with the completed command, which the caller must pass to
+*      aesd_core_commit.  The pending partial command is reset.
+* @return 1 if @param command was filled and *start advanced past it, 0 if no newline is left,
+*      in which case the remaining bytes were appended to the partial command and *start == end,
+*      or -ENOMEM if an allocation failed, in which case *start is unchanged.
+*/
+int aesd_core_next_command(struct aesd_core *core, const char **start, const char *end,
+            char **write_buf, struct aesd_buffer_entry *command)
+{
+    struct aesd_buffer_entry *partial = &core->c_buffer_entry;
+    const char *newline = memchr(*start, '\n', end - *start);
+    size_t cmd_size;
+    char *entry_buf;
+
+    if(newline == NULL){
+        if(*start == end){
+            return 0;
+        }
+        entry_buf = aesd_core_realloc(partial->buffptr, partial->size + (end - *start));
+        if(entry_buf == NULL){
+            return -ENOMEM;
+        }
+        memcpy(&entry_buf[partial->size], *start, end - *start);
+        partial->buffptr = entry_buf;
+        partial->size += end - *start;
+        *start = end;
+        return 0;
+    }
+
+    cmd_size = newline + 1 - *start;
+    if(partial->size == 0 && *start == *write_buf && newline + 1 == end){
+        // The whole write is exactly one command, hand its buffer over as is
+        entry_buf = *write_buf;
+        *write_buf = NULL;
+    }
+    else{
+        entry_buf = aesd_core_malloc(partial->size + cmd_size);
+        if(entry_buf == NULL){
+            return -ENOMEM;
+        }
+        if(partial->size){
+            memcpy(entry_buf, partial->buffptr, partial->size);
+        }
+        memcpy(&entry_buf[partial->size], *start, cmd_size);
+        aesd_core_free_buf(partial->buffptr);
+    }
+    command->buffptr = entry_buf;
+    command->size = partial->size + cmd_size;
+    partial->buffptr = NULL;
+    partial->size = 0;
+    *start = newline + 1;
+    return 1;
+}
+
+/**
+* Removes the oldest entry of @param core if committing @param size more bytes would go over
+* max_entries or max_bytes.  Call it until it returns false before aesd_core_commit.
+* @param evicted is filled with the removed entry, its memory now belongs to the caller
+* @return true if an entry was removed
+*/
+bool aesd_core_evict(struct aesd_core *core, size_t size, struct aesd_buffer_entry *evicted)
+{
+    uint8_t count = aesd_circular_buffer_entry_count(&core->c_buffer);
+
+    if(count == 0){
+        return false;
+    }
+    if(count < core->max_entries && (core->max_bytes == 0 || core->size + size <= core->max_bytes)){
+        return false;
+    }
+    aesd_circular_buffer_remove_entry(&core->c_buffer, evicted);
+    // File positions now start one entry later, read cursors taken before this point are stale
+    core->size -= evicted->size;
+    core->out_seq++;
+    return true;
+}
+
+/**
+* Adds @param command to the committed entries of @param core, which must have room for it
+* (see aesd_core_evict)
+* @return the index of c_buffer where @param command was stored
+*/
+uint8_t aesd_core_commit(struct aesd_core *core, const struct aesd_buffer_entry *command)
+{
+    uint8_t index = core->c_buffer.in_offs;
+
+    aesd_circular_buffer_add_entry(&core->c_buffer, command);
+    core->size += command->size;
+    core->head += command->size;
+    return index;
+}
+
+/**
+* Finds the entry holding @param pos, starting from @param cursor when it describes @param pos
+* and no entry was evicted since it was stored, otherwise walking the circular buffer from out_offs.
+* @param cursor may be NULL.
+* @return the entry, with the byte of pos inside it in @param entry_offset_byte_rtn, or NULL
+*      if @param pos is past the end of the data
+*/
+struct aesd_buffer_entry *aesd_core_find_entry(struct aesd_core *core, const struct aesd_read_cursor *cursor,
+            size_t pos, size_t *entry_offset_byte_rtn)
+{
+    if(cursor && cursor->valid && cursor->pos == pos && cursor->generation == core->out_seq && pos < core->size){
+        *entry_offset_byte_rtn = cursor->offset;
+        return &core->c_buffer.entry[cursor->index];
+    }
+    return aesd_circular_buffer_find_entry_offset_for_fpos(&core->c_buffer, pos, entry_offset_byte_rtn);
+}
+
+/**
+* Records in @param cursor that position @param pos is byte @param offset of @param entry
+*/
+void aesd_core_update_cursor(const struct aesd_core *core, struct aesd_read_cursor *cursor,
+            const struct aesd_buffer_entry *entry, size_t offset, size_t pos)
+{
+    cursor->index = entry - core->c_buffer.entry;
+    cursor->offset = offset;
+    // A fully read entry continues at the start of the next one, which is where the next commit goes
+    if(offset == entry->size){
+        cursor->index = (cursor->index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        cursor->offset = 0;
+    }
+    cursor->pos = pos;
+    cursor->generation = core->out_seq;
+    cursor->valid = true;
+}
+
+/**
+* @return the entry holding the command with sequence number @param seq, or NULL if it was
+*      evicted or is not committed yet
+*/
+struct aesd_buffer_entry *aesd_core_find_seq(struct aesd_core *core, uint64_t seq)
+{
+    uint8_t count = aesd_circular_buffer_entry_count(&core->c_buffer);
+
+    if(seq <= core->out_seq || seq > core->out_seq + count){
+        return NULL;
+    }
+    return &core->c_buffer.entry[(core->c_buffer.out_offs + (seq - core->out_seq - 1)) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+}
+
+/**
+* Converts the zero referenced command @param write_cmd and the zero referenced byte
+* @param write_cmd_offset inside it to a file position, walking the entries before write_cmd once.
+* @return 0 with the position in @param pos, or -EINVAL if the command or the offset within it
+*      does not exist
+*/
+int aesd_core_cmd_to_fpos(const struct aesd_core *core, uint32_t write_cmd, uint32_t write_cmd_offset,
+            size_t *pos)
+{
+    const struct aesd_circular_buffer *buffer = &core->c_buffer;
+    size_t newpos = 0;
+    uint32_t i;
+
+    if(write_cmd >= aesd_circular_buffer_entry_count(buffer)){
+        return -EINVAL;
+    }
+    for(i = 0; i < write_cmd; i++){
+        newpos += buffer->entry[(buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+    }
+    if(write_cmd_offset >= buffer->entry[(buffer->out_offs + write_cmd) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size){
+        return -EINVAL;
+    }
+    *pos = newpos + write_cmd_offset;
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * aesd-core.h
+ *
+ *  @brief Buffer logic of the aesd char driver, shared by the kernel module and user space
+ *  tests and benchmarks: accumulating partial writes, committing a command on every newline,
+ *  resolving file positions and seekto requests.
+ *
+ *  No locking is done here.  The driver holds aesd_dev.lock around the partial write helpers
+ *  and aesd_dev.buffer_lock around everything touching the committed entries.
+ */
+
+#ifndef AESD_CORE_H
+#define AESD_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+struct aesd_core
+{
+    /**
+     * Committed commands, each one ending with a newline
+     */
+    struct aesd_circular_buffer c_buffer;
+    /**
+     * Bytes written since the last newline, never contains a newline itself
+     */
+    struct aesd_buffer_entry c_buffer_entry;
+    /**
+     * Number of bytes in c_buffer, the end of the readable data
+     */
+    size_t size;
+    /**
+     * Total number of bytes ever committed.  head - size is the stream position of the
+     * first byte still held, so readers can tell how far file positions moved on eviction.
+     */
+    uint64_t head;
+    /**
+     * Number of entries evicted so far, bumped by every eviction and used as the generation
+     * of read cursors.  Commands are numbered from 1 in commit order, so the oldest entry in
+     * c_buffer has sequence number out_seq + 1.
+     */
+    uint64_t out_seq;
+    /**
+     * Eviction limits, the oldest entries are dropped before a commit would hold more than
+     * max_entries entries or more than max_bytes bytes (0 = no byte limit).  A single command
+     * larger than max_bytes is still kept, as the only entry.
+     */
+    uint8_t max_entries;
+    size_t max_bytes;
+};
+
+/**
+ * Where a previous read stopped, so a sequential read does not have to walk the circular
+ * buffer again.  Only valid while the position is still pos and no entry has been evicted
+ * since (generation == aesd_core.out_seq).
+ */
+struct aesd_read_cursor
+{
+    size_t pos;                             /* file position described by the cursor */
+    uint64_t generation;                    /* aesd_core.out_seq when the cursor was stored */
+    size_t offset;                          /* byte of pos within the entry */
+    uint8_t index;                          /* c_buffer entry holding pos */
+    bool valid;
+};
+
+extern void aesd_core_init(struct aesd_core *core);
+
+extern void aesd_core_set_limits(struct aesd_core *core, uint8_t max_entries, size_t max_bytes);
+
+extern void aesd_core_free(struct aesd_core *core);
+
+extern int aesd_core_next_command(struct aesd_core *core, const char **start, const char *end,
+            char **write_buf, struct aesd_buffer_entry *command);
+
+extern bool aesd_core_evict(struct aesd_core *core, size_t size, struct aesd_buffer_entry *evicted);
+
+extern uint8_t aesd_core_commit(struct aesd_core *core, const struct aesd_buffer_entry *command);
+
+extern struct aesd_buffer_entry *aesd_core_find_entry(struct aesd_core *core, const struct aesd_read_cursor *cursor,
+            size_t pos, size_t *entry_offset_byte_rtn);
+
+extern void aesd_core_update_cursor(const struct aesd_core *core, struct aesd_read_cursor *cursor,
+            const struct aesd_buffer_entry *entry, size_t offset, size_t pos);
+
+extern struct aesd_buffer_entry *aesd_core_find_seq(struct aesd_core *core, uint64_t seq);
+
+extern int aesd_core_cmd_to_fpos(const struct aesd_core *core, uint32_t write_cmd, uint32_t write_cmd_offset,
+            size_t *pos);
+
+#endif /* AESD_CORE_H */
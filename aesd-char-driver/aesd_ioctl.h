@@ -18,6 +18,8 @@
 #include <stdint.h>
 #endif
 
+#include "aesd-circular-buffer.h"
+
 /**
  * A structure to be passed by IOCTL from user space to kernel space, describing the type
  * of seek performed on the aesdchar driver
@@ -33,14 +35,156 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * One read of a AESDCHAR_IOCREADBATCH request
+ */
+struct aesd_read_desc {
+    /**
+     * The zero referenced write command to start reading from
+     */
+    uint32_t write_cmd;
+    /**
+     * The zero referenced offset within the write, must be inside the command
+     */
+    uint32_t write_cmd_offset;
+    /**
+     * In: the size of buf.  Out: the number of bytes copied, reading continues into the
+     * following commands until buf is full or the data ends
+     */
+    uint32_t len;
+    /**
+     * Out: 0 on success, -EINVAL if write_cmd or write_cmd_offset does not exist,
+     * -EFAULT if buf could not be written
+     */
+    int32_t status;
+    /**
+     * User space destination buffer, cast to uint64_t
+     */
+    uint64_t buf;
+};
+
+/**
+ * Argument of AESDCHAR_IOCREADBATCH, all descriptors are served under one lock acquisition
+ */
+struct aesd_read_batch {
+    /**
+     * Number of descriptors in descs, at most AESDCHAR_MAX_READ_BATCH
+     */
+    uint32_t count;
+    uint32_t reserved;
+    /**
+     * User space array of struct aesd_read_desc, cast to uint64_t
+     */
+    uint64_t descs;
+};
+
+#define AESDCHAR_MAX_READ_BATCH 1024
+
+/**
+ * Filled by AESDCHAR_IOCGSIZES with the size of every command held, oldest first
+ */
+struct aesd_entry_sizes {
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t sizes[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+/**
+ * Argument of AESDCHAR_IOCSNAPSHOT.  Positions are stream positions: the number of bytes
+ * committed to the device before that byte, which unlike file positions never move on eviction.
+ */
+struct aesd_snapshot {
+    /**
+     * In: first stream position wanted, 0 for the whole history or the generation of a
+     * previous snapshot to get only the commands committed since
+     */
+    uint64_t since;
+    /**
+     * In: user space destination buffer, cast to uint64_t
+     */
+    uint64_t buf;
+    /**
+     * In: the size of buf.  Out: the bytes copied, or the size needed when the call fails
+     * with ENOSPC, in which case nothing is copied
+     */
+    uint64_t len;
+    /**
+     * Out: stream position of the first byte copied, greater than since when the bytes in
+     * between were evicted (AESD_SNAPSHOT_TRUNCATED is then set in flags)
+     */
+    uint64_t start;
+    /**
+     * Out: stream position after the last byte copied, pass it as since to get the next delta
+     */
+    uint64_t generation;
+    /**
+     * Out: number of commands the copied bytes come from
+     */
+    uint32_t entries;
+    /**
+     * Out: AESD_SNAPSHOT_* flags
+     */
+    uint32_t flags;
+};
+
+#define AESD_SNAPSHOT_TRUNCATED 0x1
+
+/**
+ * Argument of AESDCHAR_IOCREADSINCE.  Every committed command gets a sequence number, starting
+ * at 1 and increasing by one per command, so a consumer only asks for what it has not seen.
+ */
+struct aesd_read_since {
+    /**
+     * In: return the commands with a sequence number greater than after_seq, 0 for all of them
+     */
+    uint64_t after_seq;
+    /**
+     * In: user space destination buffer, cast to uint64_t
+     */
+    uint64_t buf;
+    /**
+     * In: the size of buf.  Out: the bytes copied.  Only whole commands are copied, when not
+     * even the first one fits nothing is copied, len is set to its size and the call fails
+     * with ENOSPC
+     */
+    uint64_t len;
+    /**
+     * Out: sequence number of the first and the last command copied.  Pass last_seq as
+     * after_seq of the next call, it is left at the newest command seen when none is copied.
+     */
+    uint64_t first_seq;
+    uint64_t last_seq;
+    /**
+     * Out: number of commands after after_seq that were evicted before this call, the
+     * consumer lost them
+     */
+    uint64_t missed;
+    /**
+     * Out: number of commands copied
+     */
+    uint32_t count;
+    uint32_t reserved;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Enable (non zero) or disable (0) follow mode on this open file: reads at the end of data
+// block until a new command is written, like tail -f, or fail with EAGAIN for O_NONBLOCK files
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+// Serve an array of {write_cmd, offset, len, buf} reads in one call, returns the total bytes copied
+#define AESDCHAR_IOCREADBATCH _IOWR(AESD_IOC_MAGIC, 3, struct aesd_read_batch)
+// Get the size table of the commands currently held
+#define AESDCHAR_IOCGSIZES _IOR(AESD_IOC_MAGIC, 4, struct aesd_entry_sizes)
+// Copy the history committed after a stream position as one consistent blob, see struct aesd_snapshot
+#define AESDCHAR_IOCSNAPSHOT _IOWR(AESD_IOC_MAGIC, 5, struct aesd_snapshot)
+// Copy the commands with a sequence number greater than a given one, see struct aesd_read_since
+#define AESDCHAR_IOCREADSINCE _IOWR(AESD_IOC_MAGIC, 6, struct aesd_read_since)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 6
 
 #endif /* AESD_IOCTL_H */
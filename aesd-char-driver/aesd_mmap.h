@@ -0,0 +1,95 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read-only mapping exported by the aesd char driver mmap operation
+ *
+ *  The mapping starts with a struct aesd_mmap_header page followed by a data ring of
+ *  header.data_size bytes holding a copy of every committed write command.  The mapping
+ *  is only available when the module is loaded with a non zero mmap_size parameter.
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+#define AESD_MMAP_MAGIC 0x4145534d /* "AESM" */
+
+struct aesd_mmap_entry
+{
+    /**
+     * Position of the entry in the stream of committed bytes, the entry data starts
+     * at data ring offset (offset % data_size) and may wrap around the end of the ring
+     */
+    uint64_t offset;
+    /**
+     * Number of bytes in the entry
+     */
+    uint64_t size;
+};
+
+struct aesd_mmap_header
+{
+    uint32_t magic;
+    /**
+     * Offset of the data ring from the start of the mapping
+     */
+    uint32_t data_offset;
+    /**
+     * Size of the data ring in bytes, always a power of two
+     */
+    uint64_t data_size;
+    /**
+     * Sequence count, odd while the driver updates the header or the data ring.
+     * Readers sample it before and after copying and retry if it was odd or changed.
+     */
+    uint64_t seq;
+    /**
+     * Total number of bytes ever committed, the next entry is written at head
+     */
+    uint64_t head;
+    /**
+     * Oldest stream position still held in the data ring, entries starting before
+     * tail have been overwritten in the ring and must be skipped
+     */
+    uint64_t tail;
+    /**
+     * Number of valid entries and index in entries[] of the oldest one, entries are
+     * ordered like the circular buffer and wrap at AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+     */
+    uint32_t entry_count;
+    uint32_t first_entry;
+    struct aesd_mmap_entry entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+#ifndef __KERNEL__
+/**
+ * Copy the bytes of the mapped history starting at stream position @param pos into @param dst
+ * @param map is the start of the mapping returned by mmap()
+ * @param len is the number of bytes to copy, the range must lie within [tail, head)
+ * The caller is responsible for checking the sequence count around the copy.
+ */
+static inline void aesd_mmap_copy(const void *map, uint64_t pos, void *dst, uint64_t len)
+{
+    const struct aesd_mmap_header *hdr = (const struct aesd_mmap_header *)map;
+    const char *data = (const char *)map + hdr->data_offset;
+    uint64_t ring_pos = pos % hdr->data_size;
+    uint64_t first = hdr->data_size - ring_pos;
+
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(dst, &data[ring_pos], first);
+    memcpy((char *)dst + first, data, len - first);
+}
+#endif
+
+#endif /* AESD_MMAP_H */
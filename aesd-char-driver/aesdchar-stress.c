@@ -0,0 +1,255 @@
+/**
+ * @file aesdchar-stress.c
+ * @brief Multi-threaded reader/writer stress test for the aesdchar device
+ *
+ * Starts a number of reader threads which repeatedly seek to the start of the
+ * device and read it to the end, and a number of writer threads which keep
+ * appending newline terminated commands.  Reports read passes, bytes read and
+ * writes completed per second so lock contention between readers and the
+ * writer can be compared across reader counts.
+ *
+ * Usage: aesdchar-stress [-d device] [-r readers] [-w writers] [-t seconds] [-l line_len] [-n lines] [-s]
+ *      -n puts that many newline terminated commands in every write() call
+ *      -s sweeps the reader count 1, 2, 4 ... readers and prints one line per run
+ *
+ * Write throughput alone is measured with no readers, i.e: aesdchar-stress -r 0 -w 1 -t 10
+ * Comparing it between two module builds (or with dynamic debug sites enabled and disabled)
+ * gives the before/after cost of a driver change on the write path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#define DEFAULT_DEVICE "/dev/aesdchar"
+#define READ_CHUNK 4096
+
+struct stress_config
+{
+    const char *device;
+    int readers;
+    int writers;
+    int seconds;
+    size_t line_len;
+    size_t lines_per_write;
+};
+
+struct stress_counters
+{
+    atomic_bool stop;
+    atomic_uint_fast64_t read_passes;
+    atomic_uint_fast64_t read_bytes;
+    atomic_uint_fast64_t writes;
+    atomic_uint_fast64_t errors;
+};
+
+struct stress_thread_data
+{
+    const struct stress_config *config;
+    struct stress_counters *counters;
+};
+
+void *reader_thread(void *thread_param)
+{
+    struct stress_thread_data *data = (struct stress_thread_data *)thread_param;
+    char buf[READ_CHUNK];
+    uint64_t passes = 0;
+    uint64_t bytes = 0;
+    ssize_t rc;
+
+    int fd = open(data->config->device, O_RDONLY);
+    if (fd < 0)
+    {
+        atomic_fetch_add(&data->counters->errors, 1);
+        return NULL;
+    }
+    while (!atomic_load_explicit(&data->counters->stop, memory_order_relaxed))
+    {
+        if (lseek(fd, 0, SEEK_SET) < 0)
+        {
+            atomic_fetch_add(&data->counters->errors, 1);
+            break;
+        }
+        while ((rc = read(fd, buf, sizeof(buf))) > 0)
+        {
+            bytes += rc;
+        }
+        if (rc < 0)
+        {
+            atomic_fetch_add(&data->counters->errors, 1);
+            break;
+        }
+        passes++;
+    }
+    close(fd);
+    atomic_fetch_add(&data->counters->read_passes, passes);
+    atomic_fetch_add(&data->counters->read_bytes, bytes);
+    return NULL;
+}
+
+void *writer_thread(void *thread_param)
+{
+    struct stress_thread_data *data = (struct stress_thread_data *)thread_param;
+    size_t line_len = data->config->line_len;
+    size_t write_len = line_len * data->config->lines_per_write;
+    uint64_t writes = 0;
+    size_t i;
+
+    char *line = malloc(write_len);
+    if (line == NULL)
+    {
+        atomic_fetch_add(&data->counters->errors, 1);
+        return NULL;
+    }
+    memset(line, 'w', write_len);
+    for (i = 1; i <= data->config->lines_per_write; i++)
+    {
+        line[i * line_len - 1] = '\n';
+    }
+
+    int fd = open(data->config->device, O_WRONLY);
+    if (fd < 0)
+    {
+        atomic_fetch_add(&data->counters->errors, 1);
+        free(line);
+        return NULL;
+    }
+    while (!atomic_load_explicit(&data->counters->stop, memory_order_relaxed))
+    {
+        if (write(fd, line, write_len) != (ssize_t)write_len)
+        {
+            atomic_fetch_add(&data->counters->errors, 1);
+            break;
+        }
+        writes++;
+    }
+    close(fd);
+    free(line);
+    atomic_fetch_add(&data->counters->writes, writes);
+    return NULL;
+}
+
+double elapsed_sec(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_stress(const struct stress_config *config)
+{
+    int nthreads = config->readers + config->writers;
+    pthread_t threads[nthreads];
+    struct stress_counters counters;
+    struct stress_thread_data data = {.config = config, .counters = &counters};
+    struct timespec start, end;
+    int started = 0;
+    int i;
+
+    atomic_init(&counters.stop, false);
+    atomic_init(&counters.read_passes, 0);
+    atomic_init(&counters.read_bytes, 0);
+    atomic_init(&counters.writes, 0);
+    atomic_init(&counters.errors, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, i < config->readers ? reader_thread : writer_thread, &data) != 0)
+        {
+            perror("pthread_create");
+            atomic_store(&counters.stop, true);
+            break;
+        }
+        started++;
+    }
+    sleep(config->seconds);
+    atomic_store(&counters.stop, true);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = elapsed_sec(&start, &end);
+    printf("readers=%d writers=%d secs=%.2f read_passes/s=%.0f read_MB/s=%.1f writes/s=%.0f lines/s=%.0f write_MB/s=%.1f errors=%llu\n",
+           config->readers, config->writers, secs,
+           atomic_load(&counters.read_passes) / secs,
+           atomic_load(&counters.read_bytes) / secs / (1024 * 1024),
+           atomic_load(&counters.writes) / secs,
+           atomic_load(&counters.writes) * config->lines_per_write / secs,
+           atomic_load(&counters.writes) * config->lines_per_write * config->line_len / secs / (1024 * 1024),
+           (unsigned long long)atomic_load(&counters.errors));
+    return atomic_load(&counters.errors) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct stress_config config = {
+        .device = DEFAULT_DEVICE,
+        .readers = 4,
+        .writers = 1,
+        .seconds = 5,
+        .line_len = 64,
+        .lines_per_write = 1,
+    };
+    bool sweep = false;
+    int opt;
+    int rc = 0;
+
+    while ((opt = getopt(argc, argv, "d:r:w:t:l:n:s")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            config.device = optarg;
+            break;
+        case 'r':
+            config.readers = atoi(optarg);
+            break;
+        case 'w':
+            config.writers = atoi(optarg);
+            break;
+        case 't':
+            config.seconds = atoi(optarg);
+            break;
+        case 'l':
+            config.line_len = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            config.lines_per_write = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sweep = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-r readers] [-w writers] [-t seconds] [-l line_len] [-n lines] [-s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.readers < 0 || config.writers < 0 || config.readers + config.writers == 0 ||
+        config.seconds <= 0 || config.line_len < 1 || config.lines_per_write < 1)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    if (sweep)
+    {
+        int max_readers = config.readers;
+        for (config.readers = 1; config.readers <= max_readers; config.readers *= 2)
+        {
+            rc |= run_stress(&config);
+        }
+    }
+    else
+    {
+        rc = run_stress(&config);
+    }
+    return rc;
+}
@@ -8,34 +8,70 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug in user space builds
 
 #undef PDEBUG             /* undef it, just in case */
-#ifdef AESD_DEBUG
-#  ifdef __KERNEL__
-     /* This one if debugging is on, and kernel space */
-#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
-#  else
+#ifdef __KERNEL__
+   /*
+    * Kernel space uses pr_debug, which is a dynamic debug call site when CONFIG_DYNAMIC_DEBUG
+    * is set: disabled sites cost one static branch and can be enabled at runtime per site, i.e:
+    * echo 'module aesdchar +p' > /sys/kernel/debug/dynamic_debug/control
+    * Without dynamic debug they compile to nothing unless built with DEBUG=y (-DDEBUG)
+    */
+#  define PDEBUG(fmt, args...) pr_debug("aesdchar: " fmt "\n", ## args)
+#elif defined(AESD_DEBUG)
      /* This one for user space */
-#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
-#  endif
+#  define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
 #else
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
 #include "aesd-circular-buffer.h"
+#include "aesd-core.h"
+#include "aesd_mmap.h"
+
+#define AESD_SIZE_BUCKETS 16
+
+/**
+ * Counters shown in /proc/aesdchar
+ */
+struct aesd_stats
+{
+    atomic64_t bytes_read;                   /* updated by concurrent readers */
+    atomic64_t lock_wait_ns;                 /* time spent acquiring lock and buffer_lock */
+    atomic64_t bytes_written;                /* the fields below are updated with lock held, */
+    atomic64_t entries_added;                /* /proc/aesdchar reads them without it */
+    atomic64_t partial_reallocs;             /* writes that grew a pending partial command */
+    atomic64_t size_hist[AESD_SIZE_BUCKETS]; /* committed entries with size in [2^i, 2^(i+1)) */
+};
 
 struct aesd_dev
 {
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
-    loff_t size;
-    struct aesd_circular_buffer c_buffer;
-    struct aesd_buffer_entry c_buffer_entry;
-    struct mutex lock;
+    struct aesd_core core;                  /* c_buffer, size and out_seq are protected by buffer_lock,
+                                               c_buffer_entry (the partial command) by lock */
+    struct mutex lock;                      /* serializes writers */
+    struct rw_semaphore buffer_lock;        /* readers share, writers take it only to commit */
+    struct aesd_mmap_header *mmap_hdr;      /* mmap area, NULL unless mmap_size is set */
+    char *mmap_data;                        /* data ring following the mmap header page */
+    wait_queue_head_t read_wq;              /* woken when writes complete commands */
+    struct aesd_stats stats;
+    int minor;
     struct cdev cdev;     /* Char device structure      */
-};
+} ____cacheline_aligned_in_smp;
 
+/**
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    bool follow;                            /* block at end of data instead of returning 0 */
+    uint64_t follow_base;                   /* aesd_core.head - size when f_pos was last rebased */
+    spinlock_t cursor_lock;                 /* reads sharing the file race on the cursor */
+    struct aesd_read_cursor cursor;
+};
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -0,0 +1,78 @@
+/*
+ * aesdchar_trace.h
+ *
+ *  @brief Tracepoints of the aesd char driver, enabled through
+ *  /sys/kernel/tracing/events/aesdchar or perf record -e 'aesdchar:*'
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(_AESDCHAR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AESDCHAR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(aesd_write,
+    TP_PROTO(int minor, size_t count, size_t commands, ssize_t ret),
+    TP_ARGS(minor, count, commands, ret),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(size_t, count)
+        __field(size_t, commands)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->commands = commands;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%d count=%zu commands=%zu ret=%zd",
+              __entry->minor, __entry->count, __entry->commands, __entry->ret)
+);
+
+TRACE_EVENT(aesd_read,
+    TP_PROTO(int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%d pos=%lld count=%zu ret=%zd",
+              __entry->minor, __entry->pos, __entry->count, __entry->ret)
+);
+
+TRACE_EVENT(aesd_evict,
+    TP_PROTO(int minor, u64 seq, size_t size),
+    TP_ARGS(minor, seq, size),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(u64, seq)
+        __field(size_t, size)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->seq = seq;
+        __entry->size = size;
+    ),
+    TP_printk("minor=%d seq=%llu size=%zu",
+              __entry->minor, __entry->seq, __entry->size)
+);
+
+#endif /* _AESDCHAR_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar_trace
+#include <trace/define_trace.h>
@@ -21,19 +21,54 @@
 #include <linux/slab.h>    /* kmalloc() */
 #include <linux/kernel.h>  /* printk() */
 #include <linux/errno.h>   /* error codes */
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/uio.h>     /* iov_iter */
+#include <linux/splice.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 
 #include "aesdchar.h"
+#include "aesd-core.h"
 #include "aesd_ioctl.h"
+#include "aesd_mmap.h"
+
+#define CREATE_TRACE_POINTS
+#include "aesdchar_trace.h"
 
 int aesd_major = 0; // use dynamic major
 int aesd_minor = 0;
+int aesd_nr_devs = 1; // number of minors, each with its own buffer and locks
+module_param(aesd_nr_devs, int, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of independent aesdchar devices to create");
+
+// Size of the data ring exported through mmap, rounded up to a power of two pages, 0 disables mmap
+static unsigned long mmap_size = 0;
+module_param(mmap_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(mmap_size, "Bytes of contiguous history exported read-only through mmap (0 = disabled)");
+
+// Eviction limits of every device, the oldest commands are dropped once either one is reached
+static unsigned int max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(max_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(max_entries, "Commands kept per device, 1 to 10");
+static unsigned long max_bytes = 0;
+module_param(max_bytes, ulong, S_IRUGO);
+MODULE_PARM_DESC(max_bytes, "Bytes of commands kept per device (0 = no byte limit)");
 
 MODULE_AUTHOR("Mostafa Gamal"); /** DONE: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices; /* aesd_nr_devs devices, allocated in aesd_init_module */
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
@@ -42,8 +77,16 @@ int aesd_open(struct inode *inode, struct file *filp)
      * TODO: handle open
      */
     struct aesd_dev *dev; /* device information */
+    struct aesd_file *file_data;
     dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev; /* for other methods */
+    file_data = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (file_data == NULL)
+    {
+        return -ENOMEM;
+    }
+    file_data->dev = dev;
+    spin_lock_init(&file_data->cursor_lock);
+    filp->private_data = file_data; /* for other methods */
     PDEBUG("finished open");
 
     return 0;
@@ -53,14 +96,77 @@ int aesd_release(struct inode *inode, struct file *filp)
 {
     PDEBUG("release");
     /**
-     * TODO: handle release
+     * DONE: handle release
      */
+    kfree(filp->private_data);
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                  loff_t *f_pos)
+/**
+ * Add the time since @param wait_start to the lock wait statistic of @param dev
+ */
+static inline void aesd_account_lock_wait(struct aesd_dev *dev, u64 wait_start)
+{
+    atomic64_add(ktime_get_ns() - wait_start, &dev->stats.lock_wait_ns);
+}
+
+/**
+ * Find the entry holding @param pos, starting from the cursor left by the previous read on
+ * this file.  Must be called with buffer_lock held.
+ */
+static struct aesd_buffer_entry *aesd_find_entry_cached(struct aesd_dev *dev, struct aesd_file *file_data,
+                                                        loff_t pos, size_t *entry_offset_byte_rtn)
+{
+    struct aesd_read_cursor cursor;
+
+    spin_lock(&file_data->cursor_lock);
+    cursor = file_data->cursor;
+    spin_unlock(&file_data->cursor_lock);
+
+    return aesd_core_find_entry(&(dev->core), &cursor, pos, entry_offset_byte_rtn);
+}
+
+/**
+ * Remember that file position @param pos is byte @param offset of @param entry for the next read.
+ * Must be called with buffer_lock held.
+ */
+static void aesd_store_cursor(struct aesd_dev *dev, struct aesd_file *file_data,
+                              const struct aesd_buffer_entry *entry, size_t offset, loff_t pos)
 {
+    struct aesd_read_cursor cursor;
+
+    aesd_core_update_cursor(&(dev->core), &cursor, entry, offset, pos);
+
+    spin_lock(&file_data->cursor_lock);
+    file_data->cursor = cursor;
+    spin_unlock(&file_data->cursor_lock);
+}
+
+/**
+ * File positions count from the oldest entry, so every eviction moves the data a follow mode
+ * reader is waiting at to a lower position.  Shift @param f_pos down by the bytes evicted since
+ * the last call, so the reader continues right after what it already read.
+ * Must be called with buffer_lock held.
+ */
+static void aesd_follow_rebase(struct aesd_dev *dev, struct aesd_file *file_data, loff_t *f_pos)
+{
+    uint64_t base = dev->core.head - dev->core.size;
+    uint64_t shift = base - file_data->follow_base;
+
+    if (shift)
+    {
+        *f_pos = (uint64_t)*f_pos > shift ? *f_pos - shift : 0;
+        file_data->follow_base = base;
+    }
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *filp = iocb->ki_filp;
+    loff_t *f_pos = &iocb->ki_pos;
+    loff_t start_pos = *f_pos;
+    size_t count = iov_iter_count(to);
+    size_t requested = count;
     ssize_t retval = 0;
     PDEBUG("read %zu bytes with offset %lld", count, *f_pos);
 
@@ -68,121 +174,266 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
      * DONE: handle read
      */
     struct aesd_buffer_entry *return_buffer_entry = NULL;
-    struct aesd_dev *dev = (struct aesd_dev *)(filp->private_data);
+    struct aesd_file *file_data = (struct aesd_file *)(filp->private_data);
+    struct aesd_dev *dev = file_data->dev;
     size_t offset_rtn = 0;
     size_t bytes_to_read;
-    size_t bytes_not_read = 0;
+    size_t bytes_read;
+    u64 wait_start;
+    uint64_t head;
 
-    PDEBUG("Aquire lock");
-    if (mutex_lock_interruptible(&dev->lock))
+    PDEBUG("Aquire read lock");
+    wait_start = ktime_get_ns();
+    if (down_read_interruptible(&dev->buffer_lock))
     {
         return -ERESTARTSYS;
     }
+    aesd_account_lock_wait(dev, wait_start);
 
-    if (*f_pos >= dev->size)
+    // At the end of data a follow mode reader waits for the next command instead of returning 0
+    for (;;)
     {
-        goto out;
+        if (file_data->follow)
+        {
+            aesd_follow_rebase(dev, file_data, f_pos);
+        }
+        if (*f_pos < dev->core.size)
+        {
+            break;
+        }
+        if (!file_data->follow)
+        {
+            goto out;
+        }
+        // Evictions can leave the size unchanged, the total committed bytes always grow
+        head = dev->core.head;
+        up_read(&dev->buffer_lock);
+        if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+        {
+            return -EAGAIN;
+        }
+        PDEBUG("Wait for new data after offset %lld", *f_pos);
+        if (wait_event_interruptible(dev->read_wq, READ_ONCE(dev->core.head) != head))
+        {
+            return -ERESTARTSYS;
+        }
+        if (down_read_interruptible(&dev->buffer_lock))
+        {
+            return -ERESTARTSYS;
+        }
     }
-    if (*f_pos + count > dev->size)
+    if (*f_pos + count > dev->core.size)
     {
-        count = dev->size - *f_pos;
+        count = dev->core.size - *f_pos;
     }
 
-    do
+    // Fill the iterator across as many entries as it has room for, whatever its segments are
+    while (count)
     {
         PDEBUG("Get entry from c_buffer");
-        return_buffer_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&(dev->c_buffer), *(f_pos), &offset_rtn);
+        return_buffer_entry = aesd_find_entry_cached(dev, file_data, *f_pos, &offset_rtn);
         if (!return_buffer_entry)
         {
             PDEBUG("Getting entry returned NULL");
-            goto out;
+            break;
         }
-        else
+        bytes_to_read = return_buffer_entry->size - offset_rtn;
+        if (bytes_to_read > count)
         {
-            bytes_to_read = return_buffer_entry->size - offset_rtn;
-            if (bytes_to_read > count)
-            {
-                bytes_to_read = count;
-            }
-            PDEBUG("Copy entry to user space buffer");
-            bytes_not_read = copy_to_user(&(buf[retval]), &(return_buffer_entry->buffptr[offset_rtn]), bytes_to_read);
-            if (bytes_not_read)
+            bytes_to_read = count;
+        }
+        PDEBUG("Copy entry to user space buffer");
+        bytes_read = copy_to_iter(&(return_buffer_entry->buffptr[offset_rtn]), bytes_to_read, to);
+        *f_pos += bytes_read;
+        retval += bytes_read;
+        count -= bytes_read;
+        aesd_store_cursor(dev, file_data, return_buffer_entry, offset_rtn + bytes_read, *f_pos);
+        if (bytes_read != bytes_to_read)
+        {
+            PDEBUG("bytes_read=%zu out of bytes_to_read=%zu", bytes_read, bytes_to_read);
+            if (retval == 0)
             {
-                PDEBUG("bytes_not_read=%zu out of bytes_to_read=%zu", bytes_not_read, bytes_to_read);
+                retval = -EFAULT;
             }
-            *f_pos += (loff_t)(bytes_to_read - bytes_not_read);
-            retval += bytes_to_read - bytes_not_read;
+            break;
         }
-    } while (bytes_not_read);
+    }
 
 out:
-    mutex_unlock(&dev->lock);
+    up_read(&dev->buffer_lock);
+    if (retval > 0)
+    {
+        atomic64_add(retval, &dev->stats.bytes_read);
+    }
+    trace_aesd_read(dev->minor, start_pos, requested, retval);
     return retval;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos)
+/**
+ * Copy the entry just added at @param index of the circular buffer into the mmap data ring
+ * and publish it in the mmap header.  Must be called with buffer_lock held for writing.
+ */
+static void aesd_mmap_commit(struct aesd_dev *dev, uint8_t index, const struct aesd_buffer_entry *entry)
 {
+    struct aesd_mmap_header *hdr = dev->mmap_hdr;
+    size_t mask;
+    size_t skip = 0;
+    size_t ring_pos;
+    size_t first;
+    uint64_t oldest;
+
+    if (hdr == NULL)
+    {
+        return;
+    }
+    mask = hdr->data_size - 1;
+
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+    smp_wmb();
+
+    // Only the tail of an entry larger than the whole ring is kept
+    if (entry->size > hdr->data_size)
+    {
+        skip = entry->size - hdr->data_size;
+    }
+    ring_pos = (hdr->head + skip) & mask;
+    first = min_t(size_t, entry->size - skip, hdr->data_size - ring_pos);
+    memcpy(&dev->mmap_data[ring_pos], &entry->buffptr[skip], first);
+    memcpy(dev->mmap_data, &entry->buffptr[skip + first], entry->size - skip - first);
+
+    hdr->entries[index].offset = hdr->head;
+    hdr->entries[index].size = entry->size;
+    hdr->head += entry->size;
+    hdr->first_entry = dev->core.c_buffer.out_offs;
+    hdr->entry_count = aesd_circular_buffer_entry_count(&(dev->core.c_buffer));
+    oldest = hdr->entries[hdr->first_entry].offset;
+    if (hdr->head > hdr->data_size && hdr->head - hdr->data_size > oldest)
+    {
+        oldest = hdr->head - hdr->data_size;
+    }
+    hdr->tail = oldest;
+
+    smp_wmb();
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *filp = iocb->ki_filp;
+    loff_t *f_pos = &iocb->ki_pos;
+    size_t count = iov_iter_count(from);
     ssize_t retval = -ENOMEM;
     PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
     /**
      * DONE: handle write
      */
     /*
-        writes are accepted as string without a newline '\n' or string terminated with '\n'
-        i.e: "abcdef" or "abc\n"
-        writes with a newline in between are not handled
-        i.e: "abc\ndef"
+        every '\n' in the written data completes one command, so a single write may add
+        several entries to the circular buffer
+        i.e: "abc\ndef\n" adds "abc\n" and "def\n"
+        bytes after the last newline are kept in c_buffer_entry until a later write completes them
+        i.e: "abc\nde" adds "abc\n" and keeps "de", a following "f\n" adds "def\n"
+        c_buffer_entry never holds a newline, so only the newly written bytes are scanned
+        dev->lock serializes writers and guards c_buffer_entry, buffer_lock is only taken for
+        writing around each commit so readers keep running while entries are being built
     */
 
-    struct aesd_dev *dev = (struct aesd_dev *)(filp->private_data);
-    char *newline_exist;
-    size_t bytes_not_written = 0;
+    struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
+    struct aesd_buffer_entry add_entry;
+    struct aesd_buffer_entry evicted;
+    uint8_t add_index;
+    char *kbuf;
+    const char *data;
+    const char *start;
+    const char *end;
+    const char *tail;
+    size_t bytes_copied;
+    int rc;
+    size_t commands = 0;
+    u64 wait_start;
 
-    PDEBUG("Aquire lock");
-    if (mutex_lock_interruptible(&dev->lock))
+    if (count == 0)
     {
-        return -ERESTARTSYS;
+        return 0;
     }
 
-    PDEBUG("Memory Alloc for entry");
-    if (dev->c_buffer_entry.size == 0)
+    PDEBUG("Copy from user");
+    kbuf = kmalloc(count, GFP_KERNEL);
+    if (kbuf == NULL)
     {
-        dev->c_buffer_entry.buffptr = kmalloc(count, GFP_KERNEL);
+        return -ENOMEM;
     }
-    else
+    // Gathers all segments of a writev into one buffer, so commands may span segments
+    bytes_copied = copy_from_iter(kbuf, count, from);
+    if (bytes_copied == 0)
     {
-        dev->c_buffer_entry.buffptr = krealloc(dev->c_buffer_entry.buffptr, dev->c_buffer_entry.size + count, GFP_KERNEL);
+        kfree(kbuf);
+        return -EFAULT;
     }
-    if (dev->c_buffer_entry.buffptr == NULL)
+
+    PDEBUG("Aquire lock");
+    wait_start = ktime_get_ns();
+    if (mutex_lock_interruptible(&dev->lock))
     {
-        goto out;
+        kfree(kbuf);
+        return -ERESTARTSYS;
     }
+    aesd_account_lock_wait(dev, wait_start);
 
-    PDEBUG("Copy from user");
-    bytes_not_written = copy_from_user((void *)(&(dev->c_buffer_entry.buffptr[dev->c_buffer_entry.size])), buf, count);
-
-    retval = count - bytes_not_written;
-    dev->c_buffer_entry.size += retval;
-    dev->size += retval;
-
-    newline_exist = (char *)memchr(dev->c_buffer_entry.buffptr, '\n', dev->c_buffer_entry.size);
-    if (newline_exist != NULL)
+    data = kbuf;
+    start = data;
+    end = data + bytes_copied;
+    for (;;)
     {
+        tail = start;
+        rc = aesd_core_next_command(&(dev->core), &start, end, &kbuf, &add_entry);
+        if (rc <= 0)
+        {
+            break;
+        }
+
         PDEBUG("Add new entry to circular buffer");
-        aesd_circular_buffer_add_entry(&(dev->c_buffer), &(dev->c_buffer_entry));
-        dev->c_buffer_entry.buffptr = NULL;
-        dev->c_buffer_entry.size = 0;
+        wait_start = ktime_get_ns();
+        down_write(&dev->buffer_lock);
+        aesd_account_lock_wait(dev, wait_start);
+        // Drop the oldest entries until the new one fits the entry count and byte budget
+        while (aesd_core_evict(&(dev->core), add_entry.size, &evicted))
+        {
+            trace_aesd_evict(dev->minor, dev->core.out_seq, evicted.size);
+            kfree(evicted.buffptr);
+        }
+        add_index = aesd_core_commit(&(dev->core), &add_entry);
+        aesd_mmap_commit(dev, add_index, &add_entry);
+        up_write(&dev->buffer_lock);
+        atomic64_inc(&dev->stats.entries_added);
+        atomic64_inc(&dev->stats.size_hist[min_t(unsigned int, ilog2(add_entry.size), AESD_SIZE_BUCKETS - 1)]);
+        commands++;
+    }
+    if (rc == 0 && start != tail)
+    {
+        PDEBUG("Kept %zu bytes of partial command", (size_t)(start - tail));
+        atomic64_inc(&dev->stats.partial_reallocs);
     }
 
-out:
+    // Report the bytes consumed so far, a failed allocation only fails the write if nothing was consumed
+    if (start != data)
+    {
+        retval = start - data;
+        atomic64_add(retval, &dev->stats.bytes_written);
+    }
     mutex_unlock(&dev->lock);
+    trace_aesd_write(dev->minor, bytes_copied, commands, retval);
+    kfree(kbuf);
+    if (commands)
+    {
+        wake_up_interruptible(&dev->read_wq);
+    }
     return retval;
 }
 
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
 {
-    struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
+    struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
     loff_t newpos;
 
     switch (whence)
@@ -196,7 +447,9 @@ loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
         break;
 
     case SEEK_END:
-        newpos = dev->size + off;
+        down_read(&dev->buffer_lock);
+        newpos = dev->core.size + off;
+        up_read(&dev->buffer_lock);
         break;
 
     default: /* can't happen */
@@ -208,83 +461,471 @@ loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
     return newpos;
 }
 
-long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+static long aesd_ioctl_seekto(struct file *filp, struct aesd_dev *dev, unsigned long arg)
 {
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_buffer_entry *return_buffer_entry = NULL;
     struct aesd_seekto seekto;
-    size_t entry_offset;
     size_t newpos = 0;
     long retval;
 
-    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC)
-        return -ENOTTY;
-    if (_IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
-        return -ENOTTY;
+    if (copy_from_user(&seekto, (const struct aesd_seekto __user *)arg, sizeof(struct aesd_seekto)))
+    {
+        return -EFAULT;
+    }
+    PDEBUG("ioctl %u, %u", seekto.write_cmd, seekto.write_cmd_offset);
 
-    PDEBUG("Aquire lock");
-    if (mutex_lock_interruptible(&dev->lock))
+    PDEBUG("Aquire read lock");
+    if (down_read_interruptible(&dev->buffer_lock))
     {
-        retval = -ERESTARTSYS;
-        goto out;
+        return -ERESTARTSYS;
     }
+    retval = aesd_core_cmd_to_fpos(&(dev->core), seekto.write_cmd, seekto.write_cmd_offset, &newpos);
+    up_read(&dev->buffer_lock);
 
-    switch (cmd)
+    if (retval == 0)
     {
-    case AESDCHAR_IOCSEEKTO:
-        if (copy_from_user(&seekto, (const struct aesd_seekto __user *)arg, sizeof(struct aesd_seekto)))
+        filp->f_pos = newpos;
+        retval = newpos;
+        PDEBUG("ioctl newpos = %zu,  f_pos = %lli", newpos, filp->f_pos);
+    }
+    return retval;
+}
+
+/**
+ * Fill one batch read descriptor, copying from the start of command desc->write_cmd plus
+ * desc->write_cmd_offset and continuing into the following commands until desc->len bytes
+ * are copied or the data ends.  desc->len is updated with the bytes copied.
+ * Must be called with buffer_lock held.
+ */
+static long aesd_read_desc(struct aesd_dev *dev, struct aesd_read_desc *desc)
+{
+    struct aesd_circular_buffer *buffer = &(dev->core.c_buffer);
+    uint8_t entries = aesd_circular_buffer_entry_count(buffer);
+    char __user *ubuf = u64_to_user_ptr(desc->buf);
+    const struct aesd_buffer_entry *entry;
+    size_t offset = desc->write_cmd_offset;
+    uint32_t copied = 0;
+    uint32_t chunk;
+    uint32_t i = desc->write_cmd;
+
+    if (i >= entries ||
+        offset >= buffer->entry[(buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size)
+    {
+        desc->len = 0;
+        return -EINVAL;
+    }
+    for (; copied < desc->len && i < entries; i++, offset = 0)
+    {
+        entry = &(buffer->entry[(buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]);
+        chunk = min_t(size_t, entry->size - offset, desc->len - copied);
+        if (copy_to_user(&ubuf[copied], &(entry->buffptr[offset]), chunk))
         {
-            retval = -EACCES;
-            goto out;
+            desc->len = copied;
+            return -EFAULT;
+        }
+        copied += chunk;
+    }
+    desc->len = copied;
+    return 0;
+}
+
+static long aesd_ioctl_read_batch(struct aesd_dev *dev, unsigned long arg)
+{
+    struct aesd_read_batch batch;
+    struct aesd_read_desc *descs;
+    struct aesd_read_desc __user *udescs;
+    long retval = 0;
+    uint32_t i;
+
+    if (copy_from_user(&batch, (const struct aesd_read_batch __user *)arg, sizeof(batch)))
+    {
+        return -EFAULT;
+    }
+    if (batch.count == 0 || batch.count > AESDCHAR_MAX_READ_BATCH)
+    {
+        return -EINVAL;
+    }
+    udescs = u64_to_user_ptr(batch.descs);
+    descs = memdup_user(udescs, batch.count * sizeof(struct aesd_read_desc));
+    if (IS_ERR(descs))
+    {
+        return PTR_ERR(descs);
+    }
+
+    PDEBUG("Aquire read lock for %u descriptors", batch.count);
+    if (down_read_interruptible(&dev->buffer_lock))
+    {
+        kfree(descs);
+        return -ERESTARTSYS;
+    }
+    for (i = 0; i < batch.count; i++)
+    {
+        descs[i].status = aesd_read_desc(dev, &descs[i]);
+        retval += descs[i].len;
+    }
+    up_read(&dev->buffer_lock);
+
+    if (copy_to_user(udescs, descs, batch.count * sizeof(struct aesd_read_desc)))
+    {
+        retval = -EFAULT;
+    }
+    kfree(descs);
+    return retval;
+}
+
+static long aesd_ioctl_entry_sizes(struct aesd_dev *dev, unsigned long arg)
+{
+    struct aesd_circular_buffer *buffer = &(dev->core.c_buffer);
+    struct aesd_entry_sizes sizes;
+    uint32_t i;
+
+    memset(&sizes, 0, sizeof(sizes));
+    if (down_read_interruptible(&dev->buffer_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    sizes.count = aesd_circular_buffer_entry_count(buffer);
+    for (i = 0; i < sizes.count; i++)
+    {
+        sizes.sizes[i] = buffer->entry[(buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+    }
+    up_read(&dev->buffer_lock);
+
+    if (copy_to_user((struct aesd_entry_sizes __user *)arg, &sizes, sizeof(sizes)))
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+/**
+ * Copy every byte committed from stream position snap.since on straight from the entries to
+ * the user buffer, all under one read lock so the blob matches exactly one generation
+ */
+static long aesd_ioctl_snapshot(struct aesd_dev *dev, unsigned long arg)
+{
+    struct aesd_circular_buffer *buffer = &(dev->core.c_buffer);
+    struct aesd_snapshot snap;
+    char __user *ubuf;
+    const struct aesd_buffer_entry *entry;
+    uint64_t tail;
+    uint64_t copied = 0;
+    size_t pos;
+    uint8_t entries;
+    uint8_t i;
+    long retval = 0;
+
+    if (copy_from_user(&snap, (const void __user *)arg, sizeof(snap)))
+    {
+        return -EFAULT;
+    }
+    ubuf = u64_to_user_ptr(snap.buf);
+
+    if (down_read_interruptible(&dev->buffer_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    tail = dev->core.head - dev->core.size;
+    if (snap.since > dev->core.head)
+    {
+        retval = -EINVAL;
+        goto out_unlock;
+    }
+    snap.flags = snap.since < tail ? AESD_SNAPSHOT_TRUNCATED : 0;
+    snap.start = max(snap.since, tail);
+    snap.generation = dev->core.head;
+    snap.entries = 0;
+    if (snap.len < snap.generation - snap.start)
+    {
+        snap.len = snap.generation - snap.start;
+        retval = -ENOSPC;
+        goto out_unlock;
+    }
+
+    pos = snap.start - tail;
+    entries = aesd_circular_buffer_entry_count(buffer);
+    for (i = 0; i < entries; i++)
+    {
+        entry = &(buffer->entry[(buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]);
+        if (pos >= entry->size)
+        {
+            pos -= entry->size;
+            continue;
+        }
+        if (copy_to_user(&ubuf[copied], &(entry->buffptr[pos]), entry->size - pos))
+        {
+            retval = -EFAULT;
+            goto out_unlock;
         }
-        PDEBUG("ioctl %u, %u", seekto.write_cmd, seekto.write_cmd_offset);
-        int i;
-        for (i = 0; i < seekto.write_cmd; ++i)
+        copied += entry->size - pos;
+        pos = 0;
+        snap.entries++;
+    }
+    snap.len = copied;
+
+out_unlock:
+    up_read(&dev->buffer_lock);
+    PDEBUG("ioctl snapshot since %llu start %llu generation %llu len %llu ret %ld",
+           snap.since, snap.start, snap.generation, snap.len, retval);
+    if ((retval == 0 || retval == -ENOSPC) && copy_to_user((void __user *)arg, &snap, sizeof(snap)))
+    {
+        retval = -EFAULT;
+    }
+    return retval;
+}
+
+/**
+ * Copy the whole commands after sequence number req.after_seq, reporting the ones already evicted
+ */
+static long aesd_ioctl_read_since(struct aesd_dev *dev, unsigned long arg)
+{
+    struct aesd_read_since req;
+    char __user *ubuf;
+    const struct aesd_buffer_entry *entry;
+    uint64_t copied = 0;
+    uint64_t seq;
+    long retval = 0;
+
+    if (copy_from_user(&req, (const void __user *)arg, sizeof(req)))
+    {
+        return -EFAULT;
+    }
+    ubuf = u64_to_user_ptr(req.buf);
+
+    if (down_read_interruptible(&dev->buffer_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    if (req.after_seq > dev->core.out_seq + aesd_circular_buffer_entry_count(&(dev->core.c_buffer)))
+    {
+        retval = -EINVAL;
+        goto out_unlock;
+    }
+    seq = req.after_seq + 1;
+    req.missed = 0;
+    if (seq <= dev->core.out_seq)
+    {
+        req.missed = dev->core.out_seq + 1 - seq;
+        seq = dev->core.out_seq + 1;
+    }
+    req.first_seq = seq;
+    req.count = 0;
+    while ((entry = aesd_core_find_seq(&(dev->core), seq)) != NULL)
+    {
+        if (entry->size > req.len - copied)
         {
-            return_buffer_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&(dev->c_buffer), newpos, &entry_offset);
-            if (!return_buffer_entry)
+            if (req.count == 0)
             {
-                retval = -EINVAL;
-                goto out;
+                req.len = entry->size;
+                retval = -ENOSPC;
+                goto out_unlock;
             }
-            newpos += return_buffer_entry->size;
+            break;
         }
-        newpos += seekto.write_cmd_offset;
-        return_buffer_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&(dev->c_buffer), newpos, &entry_offset);
-        if (!return_buffer_entry)
+        if (copy_to_user(&ubuf[copied], entry->buffptr, entry->size))
         {
-            retval = -EINVAL;
-            goto out;
+            retval = -EFAULT;
+            goto out_unlock;
         }
+        copied += entry->size;
+        req.count++;
+        seq++;
+    }
+    req.last_seq = seq - 1;
+    req.len = copied;
 
-        filp->f_pos = newpos;
-        retval = newpos;
-        PDEBUG("ioctl newpos = %lli,  f_pos = %lli", newpos, filp->f_pos);
-        break;
+out_unlock:
+    up_read(&dev->buffer_lock);
+    PDEBUG("ioctl read since %llu missed %llu count %u ret %ld", req.after_seq, req.missed, req.count, retval);
+    if ((retval == 0 || retval == -ENOSPC) && copy_to_user((void __user *)arg, &req, sizeof(req)))
+    {
+        retval = -EFAULT;
+    }
+    return retval;
+}
+
+long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct aesd_file *file_data = filp->private_data;
+    struct aesd_dev *dev = file_data->dev;
+    uint32_t follow;
+
+    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC)
+        return -ENOTTY;
+    if (_IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
+        return -ENOTTY;
+
+    switch (cmd)
+    {
+    case AESDCHAR_IOCSEEKTO:
+        return aesd_ioctl_seekto(filp, dev, arg);
+
+    case AESDCHAR_IOCFOLLOW:
+        // Per file setting, the lock only makes the eviction baseline consistent
+        if (copy_from_user(&follow, (const uint32_t __user *)arg, sizeof(follow)))
+        {
+            return -EFAULT;
+        }
+        PDEBUG("ioctl follow %u", follow);
+        down_read(&dev->buffer_lock);
+        file_data->follow_base = dev->core.head - dev->core.size;
+        file_data->follow = follow != 0;
+        up_read(&dev->buffer_lock);
+        return 0;
+
+    case AESDCHAR_IOCREADBATCH:
+        return aesd_ioctl_read_batch(dev, arg);
+
+    case AESDCHAR_IOCGSIZES:
+        return aesd_ioctl_entry_sizes(dev, arg);
+
+    case AESDCHAR_IOCSNAPSHOT:
+        return aesd_ioctl_snapshot(dev, arg);
+
+    case AESDCHAR_IOCREADSINCE:
+        return aesd_ioctl_read_since(dev, arg);
 
     default: /* redundant, as cmd was checked against MAXNR */
-        retval = -ENOTTY;
-        goto out;
+        return -ENOTTY;
     }
+}
 
-out:
-    mutex_unlock(&dev->lock);
-    return retval;
+__poll_t aesd_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    struct aesd_file *file_data = filp->private_data;
+    struct aesd_dev *dev = file_data->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+    bool readable;
+
+    poll_wait(filp, &dev->read_wq, wait);
+
+    down_read(&dev->buffer_lock);
+    if (file_data->follow)
+    {
+        // Compare stream positions, f_pos is only rebased by the next read
+        readable = file_data->follow_base + filp->f_pos < dev->core.head;
+    }
+    else
+    {
+        readable = filp->f_pos < dev->core.size;
+    }
+    if (readable)
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    up_read(&dev->buffer_lock);
+    return mask;
+}
+
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
+
+    if (dev->mmap_hdr == NULL)
+    {
+        return -ENODEV;
+    }
+    // The mapping exposes the driver's own storage, never allow it to become writable
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    return remap_vmalloc_range(vma, dev->mmap_hdr, vma->vm_pgoff);
 }
 
 struct file_operations aesd_fops = {
     .owner = THIS_MODULE,
-    .read = aesd_read,
-    .write = aesd_write,
+    .read_iter = aesd_read_iter,
+    .write_iter = aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
     .open = aesd_open,
     .llseek = aesd_llseek,
     .unlocked_ioctl = aesd_ioctl,
+    .poll = aesd_poll,
+    .mmap = aesd_mmap,
     .release = aesd_release,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_mmap_init(struct aesd_dev *dev)
+{
+    unsigned long data_size;
+
+    if (mmap_size == 0)
+    {
+        return 0;
+    }
+    data_size = roundup_pow_of_two(PAGE_ALIGN(mmap_size));
+    // vmalloc_user memory is zeroed and can be handed to remap_vmalloc_range
+    dev->mmap_hdr = vmalloc_user(PAGE_SIZE + data_size);
+    if (dev->mmap_hdr == NULL)
+    {
+        return -ENOMEM;
+    }
+    dev->mmap_hdr->magic = AESD_MMAP_MAGIC;
+    dev->mmap_hdr->data_offset = PAGE_SIZE;
+    dev->mmap_hdr->data_size = data_size;
+    dev->mmap_data = (char *)dev->mmap_hdr + PAGE_SIZE;
+    return 0;
+}
+
+static int aesd_proc_show(struct seq_file *s, void *v)
+{
+    struct aesd_dev *dev;
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
+    size_t footprint;
+    int i;
+    int bucket;
+
+    for (i = 0; i < aesd_nr_devs; i++)
+    {
+        dev = &aesd_devices[i];
+        footprint = sizeof(struct aesd_dev) + READ_ONCE(dev->core.c_buffer_entry.size);
+        if (dev->mmap_hdr)
+        {
+            footprint += PAGE_SIZE + dev->mmap_hdr->data_size;
+        }
+        down_read(&dev->buffer_lock);
+        AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->core.c_buffer, index)
+        {
+            footprint += entry->buffptr ? entry->size : 0;
+        }
+        seq_printf(s, "aesdchar%d:\n", dev->minor);
+        seq_printf(s, "  bytes_written    %lld\n", atomic64_read(&dev->stats.bytes_written));
+        seq_printf(s, "  bytes_read       %lld\n", atomic64_read(&dev->stats.bytes_read));
+        seq_printf(s, "  entries_added    %lld\n", atomic64_read(&dev->stats.entries_added));
+        seq_printf(s, "  entries_evicted  %llu\n", dev->core.out_seq);
+        seq_printf(s, "  entries_held     %u\n", aesd_circular_buffer_entry_count(&dev->core.c_buffer));
+        seq_printf(s, "  bytes_held       %zu\n", dev->core.size);
+        seq_printf(s, "  bytes_evicted    %llu\n", dev->core.head - dev->core.size);
+        seq_printf(s, "  partial_reallocs %lld\n", atomic64_read(&dev->stats.partial_reallocs));
+        seq_printf(s, "  lock_wait_ns     %lld\n", atomic64_read(&dev->stats.lock_wait_ns));
+        seq_printf(s, "  memory_bytes     %zu\n", footprint);
+        seq_puts(s, "  entry_sizes     ");
+        for (bucket = 0; bucket < AESD_SIZE_BUCKETS; bucket++)
+        {
+            seq_printf(s, " %s%lu:%lld", bucket == AESD_SIZE_BUCKETS - 1 ? ">=" : "<",
+                       bucket == AESD_SIZE_BUCKETS - 1 ? 1UL << bucket : 2UL << bucket,
+                       atomic64_read(&dev->stats.size_hist[bucket]));
+        }
+        seq_putc(s, '\n');
+        up_read(&dev->buffer_lock);
+    }
+    return 0;
+}
+
+static int aesd_setup_cdev(struct aesd_dev *dev, int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
@@ -292,16 +933,37 @@ static int aesd_setup_cdev(struct aesd_dev *dev)
     err = cdev_add(&dev->cdev, devno, 1);
     if (err)
     {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %d", err, index);
     }
     return err;
 }
 
+/**
+ * Free the memory owned by @param dev, its cdev must already be removed
+ */
+static void aesd_free_device(struct aesd_dev *dev)
+{
+    aesd_core_free(&(dev->core));
+    vfree(dev->mmap_hdr);
+}
+
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    int i;
+
+    if (aesd_nr_devs < 1)
+    {
+        printk(KERN_WARNING "aesd_nr_devs=%d is invalid\n", aesd_nr_devs);
+        return -EINVAL;
+    }
+    if (max_entries < 1 || max_entries > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+    {
+        printk(KERN_WARNING "max_entries=%u is invalid\n", max_entries);
+        return -EINVAL;
+    }
+    result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs,
                                  "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0)
@@ -309,41 +971,82 @@ int aesd_init_module(void)
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device, 0, sizeof(struct aesd_dev));
+
+    // struct aesd_dev is cacheline aligned, so devices in the array never share a line
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (aesd_devices == NULL)
+    {
+        result = -ENOMEM;
+        goto fail_region;
+    }
 
     /**
-     * TODO: initialize the AESD specific portion of the device
+     * DONE: initialize the AESD specific portion of the device
      */
-    PDEBUG("Initializing Mutex");
-    mutex_init(&aesd_device.lock);
+    for (i = 0; i < aesd_nr_devs; i++)
+    {
+        PDEBUG("Initializing device %d", i);
+        aesd_devices[i].minor = aesd_minor + i;
+        mutex_init(&aesd_devices[i].lock);
+        init_rwsem(&aesd_devices[i].buffer_lock);
+        init_waitqueue_head(&aesd_devices[i].read_wq);
+        aesd_core_init(&aesd_devices[i].core);
+        aesd_core_set_limits(&aesd_devices[i].core, max_entries, max_bytes);
+        result = aesd_mmap_init(&aesd_devices[i]);
+        if (result)
+        {
+            goto fail_devices;
+        }
+    }
 
-    result = aesd_setup_cdev(&aesd_device);
+    for (i = 0; i < aesd_nr_devs; i++)
+    {
+        result = aesd_setup_cdev(&aesd_devices[i], i);
+        if (result)
+        {
+            while (--i >= 0)
+            {
+                cdev_del(&aesd_devices[i].cdev);
+            }
+            goto fail_devices;
+        }
+    }
 
-    if (result)
+    if (proc_create_single("aesdchar", 0444, NULL, aesd_proc_show) == NULL)
     {
-        unregister_chrdev_region(dev, 1);
+        printk(KERN_WARNING "aesdchar: could not create /proc/aesdchar\n");
     }
+    return 0;
+
+fail_devices:
+    for (i = 0; i < aesd_nr_devs; i++)
+    {
+        aesd_free_device(&aesd_devices[i]);
+    }
+    kfree(aesd_devices);
+fail_region:
+    unregister_chrdev_region(dev, aesd_nr_devs);
     return result;
 }
 
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
-
-    cdev_del(&aesd_device.cdev);
+    int i;
 
     /**
-     * TODO: cleanup AESD specific poritions here as necessary
+     * DONE: cleanup AESD specific poritions here as necessary
      */
-    PDEBUG("Free allocated memory for aesd_device c_buffer entries");
-    int i;
-    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+    remove_proc_entry("aesdchar", NULL);
+    for (i = 0; i < aesd_nr_devs; i++)
     {
-        if (aesd_device.c_buffer.entry[i].buffptr)
-            kfree(aesd_device.c_buffer.entry[i].buffptr);
+        cdev_del(&aesd_devices[i].cdev);
+        PDEBUG("Free allocated memory for device %d", i);
+        aesd_free_device(&aesd_devices[i]);
     }
+    kfree(aesd_devices);
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, aesd_nr_devs);
 }
 
 module_init(aesd_init_module);
@@ -0,0 +1,153 @@
+/**
+ * @file systemcalls-bench.c
+ * @brief Spawn latency of do_exec_argv() with fork() and with posix_spawn() from a large parent
+ *
+ * Grows the resident set of the process to the requested size, then runs the
+ * same command the requested number of times with each method and prints the
+ * mean, median and 99th percentile latency of one do_exec_argv() call.
+ * fork() copies the page tables of the whole resident set on every call,
+ * posix_spawn() does not, so the gap widens with -m.
+ * With -p the same spawns also run through do_exec_batch(), -p at a time, and
+ * the total wall clock time is compared with running them one after the other.
+ *
+ * Usage: systemcalls-bench [-n spawns] [-m rss_mb] [-p parallel] [command [args...]]
+ *      the command defaults to /bin/true and must be a full path
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "systemcalls.h"
+
+static double elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_bench(const char *name, enum exec_method method, char *const command[], int spawns, double *samples)
+{
+    struct timespec start, end;
+    double total = 0;
+    int failures = 0;
+    int i;
+
+    for (i = 0; i < spawns; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!do_exec_argv(method, NULL, command))
+        {
+            failures++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[i] = elapsed_us(&start, &end);
+        total += samples[i];
+    }
+    qsort(samples, spawns, sizeof(double), compare_double);
+    printf("method=%s spawns=%d mean_us=%.1f p50_us=%.1f p99_us=%.1f failures=%d\n",
+           name, spawns, total / spawns, samples[spawns / 2], samples[(int)(spawns * 0.99)], failures);
+    return failures ? 1 : 0;
+}
+
+static int run_batch(char *const command[], int spawns, unsigned int parallel)
+{
+    struct exec_job *jobs = calloc(spawns, sizeof(struct exec_job));
+    struct timespec start, end;
+    double total = 0;
+    bool result;
+    int i;
+
+    if (jobs == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < spawns; i++)
+    {
+        jobs[i].command = command;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = do_exec_batch(jobs, spawns, parallel);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (i = 0; i < spawns; i++)
+    {
+        total += jobs[i].elapsed_sec;
+        free(jobs[i].output.data);
+    }
+    printf("method=batch parallel=%u spawns=%d wall_ms=%.1f mean_command_us=%.1f result=%d\n",
+           parallel, spawns, elapsed_us(&start, &end) / 1e3, total * 1e6 / spawns, result);
+    free(jobs);
+    return result ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char *default_command[] = {"/bin/true", NULL};
+    char *const *command = default_command;
+    size_t rss_mb = 1024;
+    int spawns = 2000;
+    unsigned int parallel = 0;
+    double *samples;
+    char *ballast;
+    int opt;
+    int rc = 0;
+
+    while ((opt = getopt(argc, argv, "n:m:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            spawns = atoi(optarg);
+            break;
+        case 'm':
+            rss_mb = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            parallel = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n spawns] [-m rss_mb] [-p parallel] [command [args...]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (spawns < 1)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+    if (optind < argc)
+    {
+        command = &argv[optind];
+    }
+
+    samples = malloc(spawns * sizeof(double));
+    // Touch every page so the memory is resident and fork() has page tables to copy
+    ballast = malloc(rss_mb * 1024 * 1024 + 1);
+    if (samples == NULL || ballast == NULL)
+    {
+        perror("malloc");
+        return 1;
+    }
+    memset(ballast, 1, rss_mb * 1024 * 1024 + 1);
+    printf("rss_mb=%zu command=%s\n", rss_mb, command[0]);
+
+    rc |= run_bench("fork", EXEC_FORK, command, spawns, samples);
+    rc |= run_bench("posix_spawn", EXEC_SPAWN, command, spawns, samples);
+    if (parallel)
+    {
+        rc |= run_batch(command, spawns, parallel);
+    }
+
+    free(ballast);
+    free(samples);
+    return rc;
+}
@@ -1,4 +1,11 @@
+#define _GNU_SOURCE /* pipe2() */
 #include "systemcalls.h"
+#include <spawn.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+extern char **environ;
 
 /**
  * @param cmd the command to execute with system()
@@ -60,20 +67,8 @@ bool do_exec(int count, ...)
  *   as second argument to the execv() command.
  *
 */
-    pid_t pid;
-    int status;
-    bool result = false;
+    bool result = do_exec_argv(EXEC_SPAWN, NULL, command);
 
-    pid = fork();
-    if(pid == 0){
-        execv(command[0], command);
-        exit(EXIT_FAILURE);
-    }
-    else{
-        pid = waitpid(pid, &status, 0);
-        if(pid > 0 && WIFEXITED(status)==true && WEXITSTATUS(status)==0) result = true;
-    }
-    
     va_end(args);
     return result;
 }
@@ -103,25 +98,362 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
  *   The rest of the behaviour is same as do_exec()
  *
 */
+    bool result = do_exec_argv(EXEC_SPAWN, outputfile, command);
+
+    va_end(args);
+
+    return result;
+}
+
+/**
+* Starts @param command with fork() and execv(), with stdout on @param fd when it is not -1
+* @return the child pid, or -1 if fork failed
+*/
+static pid_t start_fork(char *const command[], int fd)
+{
+    pid_t pid = fork();
+    if(pid == 0){
+        if(fd >= 0){
+            if(dup2(fd, STDOUT_FILENO) < 0) _exit(EXIT_FAILURE);
+            close(fd);
+        }
+        execv(command[0], command);
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+/**
+* Starts @param command with posix_spawn(), with stdout on @param out_fd and stderr on
+* @param err_fd when they are not -1.
+* glibc implements it with clone(CLONE_VM|CLONE_VFORK), so the parent's page tables are
+* never copied however large its resident set is.
+* @return the child pid, or -1 if the command could not be started
+*/
+static pid_t start_spawn(char *const command[], int out_fd, int err_fd)
+{
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int rc;
+
+    if(posix_spawn_file_actions_init(&actions) != 0) return -1;
+    if((out_fd >= 0 && posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO) != 0) ||
+       (err_fd >= 0 && posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO) != 0)){
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    // Like execv(), no PATH search: command[0] must be a full path
+    rc = posix_spawn(&pid, command[0], &actions, NULL, command, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(rc != 0){
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+* @param method - how to start the child, see enum exec_method
+* @param outputfile - The full path to the file receiving the command stdout, created or
+*   truncated first, or NULL to leave stdout alone
+* @param command - NULL terminated argument vector, command[0] is the full path to execute
+* @return true if the command was started and exited with status 0, same as do_exec()
+*/
+bool do_exec_argv(enum exec_method method, const char *outputfile, char *const command[])
+{
     int status;
-    bool result = false;
+    int fd = -1;
     pid_t pid;
-    int fd = open(outputfile, O_WRONLY);
-    if (fd < 0) { perror("open"); return result; }
-    switch (pid = fork()) {
-    case -1: return result;
-    case 0:
-        if (dup2(fd, 1) < 0) {return result; }
-        close(fd);
-        execv(command[0], command);
-        exit(EXIT_FAILURE);
-    default:
-        close(fd);
-        pid = waitpid(pid, &status, 0);
-        if(pid > 0 && WIFEXITED(status)==true && WEXITSTATUS(status)==0) result = true;
+
+    if(outputfile != NULL){
+        fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0){
+            perror("open");
+            return false;
+        }
     }
+    pid = (method == EXEC_FORK) ? start_fork(command, fd) : start_spawn(command, fd, -1);
+    if(fd >= 0) close(fd);
+    if(pid < 0) return false;
 
-    va_end(args);
+    pid = waitpid(pid, &status, 0);
+    return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+* Appends everything readable on the non blocking @param fd to @param out.  Once out->limit
+* bytes are kept the rest is still read, so the writer never blocks, but dropped.
+* @return 0 at end of file, 1 if the writer may still send more, -1 on error
+*/
+static int output_drain(int fd, struct exec_output *out)
+{
+    char discard[4096];
+    char *data;
+    ssize_t n;
 
+    for(;;){
+        if(out->limit && out->len >= out->limit){
+            n = read(fd, discard, sizeof(discard));
+            if(n > 0){
+                out->truncated = true;
+                continue;
+            }
+            if(n == 0) return 0;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            if(errno != EINTR) return -1;
+            continue;
+        }
+        // Keep at least one byte free for the NUL terminator
+        if(out->size - out->len < 2){
+            size_t size = out->size ? out->size * 2 : 4096;
+            data = realloc(out->data, size);
+            if(data == NULL) return -1;
+            out->data = data;
+            out->size = size;
+            out->data[out->len] = '\0';
+        }
+        n = out->size - out->len - 1;
+        if(out->limit && (size_t)n > out->limit - out->len){
+            n = out->limit - out->len;
+        }
+        n = read(fd, &out->data[out->len], n);
+        if(n > 0){
+            out->len += n;
+            out->data[out->len] = '\0';
+        }
+        else if(n == 0){
+            return 0;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK){
+            return 1;
+        }
+        else if(errno != EINTR){
+            return -1;
+        }
+    }
+}
+
+/**
+* Resets @param out and opens the pipe it is filled from, non blocking on the read side
+* @return true with the read end in fds[0] and the write end in fds[1]
+*/
+static bool output_pipe(struct exec_output *out, int fds[2])
+{
+    out->data = NULL;
+    out->len = 0;
+    out->size = 0;
+    out->truncated = false;
+    if(pipe2(fds, O_CLOEXEC) != 0) return false;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+/**
+* Runs @param command with its stdout captured in @param out and its stderr in @param err,
+* through pipes instead of a file, so large outputs never touch the disk.  A small epoll loop
+* drains both pipes as the command writes, growing the buffers up to their limit.
+* @param err - NULL to leave stderr alone
+* @return true if the command was started and exited with status 0, same as do_exec().
+*   Whatever was captured is left in @param out and @param err either way, free their data.
+*/
+bool do_exec_capture(char *const command[], struct exec_output *out, struct exec_output *err)
+{
+    struct exec_output *outputs[2] = {out, err};
+    int fds[2][2] = {{-1, -1}, {-1, -1}};
+    struct epoll_event ev;
+    int open_fds = 0;
+    int status = -1;
+    int epfd = -1;
+    pid_t pid = -1;
+    int i;
+
+    for(i = 0; i < 2; i++){
+        if(outputs[i] != NULL && !output_pipe(outputs[i], fds[i])) goto out;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0) goto out;
+    for(i = 0; i < 2; i++){
+        if(fds[i][0] < 0) continue;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i][0], &ev) != 0) goto out;
+        open_fds++;
+    }
+
+    pid = start_spawn(command, fds[0][1], fds[1][1]);
+    // The child holds its own copies now, end of file comes when it closes them
+    for(i = 0; i < 2; i++){
+        if(fds[i][1] >= 0){
+            close(fds[i][1]);
+            fds[i][1] = -1;
+        }
+    }
+    if(pid < 0) goto out;
+
+    while(open_fds > 0){
+        struct epoll_event events[2];
+        int n = epoll_wait(epfd, events, 2, -1);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            break;
+        }
+        for(i = 0; i < n; i++){
+            int index = events[i].data.u32;
+            if(output_drain(fds[index][0], outputs[index]) <= 0){
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fds[index][0], NULL);
+                close(fds[index][0]);
+                fds[index][0] = -1;
+                open_fds--;
+            }
+        }
+    }
+    waitpid(pid, &status, 0);
+
+out:
+    for(i = 0; i < 2; i++){
+        if(fds[i][0] >= 0) close(fds[i][0]);
+        if(fds[i][1] >= 0) close(fds[i][1]);
+    }
+    if(epfd >= 0) close(epfd);
+    return pid > 0 && status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+* Starts @param job with its stdout on a pipe, registering the pipe and a pidfd of the child
+* with @param epfd.  The epoll data is the job index times two, plus one for the pidfd.
+* @return true if the command was started
+*/
+static bool batch_start(int epfd, struct exec_job *job, size_t index)
+{
+    struct epoll_event ev;
+    int fds[2];
+
+    job->status = -1;
+    job->pidfd = -1;
+    job->out_fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    if(!output_pipe(&job->output, fds)) return false;
+
+    job->pid = start_spawn(job->command, fds[1], -1);
+    close(fds[1]);
+    if(job->pid < 0){
+        close(fds[0]);
+        return false;
+    }
+    job->out_fd = fds[0];
+    ev.events = EPOLLIN;
+    ev.data.u64 = index * 2;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, job->out_fd, &ev);
+
+    // Before Linux 5.3 there is no pidfd, the child is then reaped once its stdout closes
+    job->pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+    if(job->pidfd >= 0){
+        ev.events = EPOLLIN;
+        ev.data.u64 = index * 2 + 1;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, job->pidfd, &ev);
+    }
+    return true;
+}
+
+/**
+* Reaps the child of @param job, blocking only when no pidfd reported its exit
+*/
+static void batch_reap(struct exec_job *job)
+{
+    struct timespec end;
+
+    waitpid(job->pid, &job->status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->elapsed_sec = (end.tv_sec - job->start.tv_sec) + (end.tv_nsec - job->start.tv_nsec) / 1e9;
+    job->pid = -1;
+    if(job->pidfd >= 0){
+        close(job->pidfd);
+        job->pidfd = -1;
+    }
+}
+
+/**
+* Runs the commands of @param jobs, at most @param max_parallel at a time, capturing the stdout
+* of each one in its own pipe.  A single epoll loop drains the pipes and reaps exited children
+* through pidfds, so a slow command never holds back the start of the next one.
+* @param count - the number of entries in @param jobs
+* @param max_parallel - the number of commands running at once, 0 runs them all at once
+* @return true if every command was started and exited with status 0.  The status, output and
+*   wall clock time of each command are reported in its struct exec_job either way.
+*/
+bool do_exec_batch(struct exec_job *jobs, size_t count, unsigned int max_parallel)
+{
+    struct epoll_event events[64];
+    size_t next = 0;
+    size_t running = 0;
+    bool result = true;
+    int epfd;
+    int n;
+    int i;
+
+    for(next = 0; next < count; next++){
+        jobs[next].output.data = NULL;
+        jobs[next].output.len = 0;
+        jobs[next].output.size = 0;
+        jobs[next].output.truncated = false;
+        jobs[next].status = -1;
+        jobs[next].pid = -1;
+        jobs[next].pidfd = -1;
+        jobs[next].out_fd = -1;
+        jobs[next].elapsed_sec = 0;
+    }
+    if(max_parallel == 0 || max_parallel > count) max_parallel = count;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0){
+        perror("epoll_create1");
+        return false;
+    }
+
+    next = 0;
+    while(next < count || running > 0){
+        while(next < count && running < max_parallel){
+            if(batch_start(epfd, &jobs[next], next)){
+                running++;
+            }
+            else{
+                result = false;
+            }
+            next++;
+        }
+        if(running == 0) continue;
+
+        n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            perror("epoll_wait");
+            result = false;
+            break;
+        }
+        for(i = 0; i < n; i++){
+            struct exec_job *job = &jobs[events[i].data.u64 / 2];
+
+            if(events[i].data.u64 % 2){
+                // The pidfd is readable once the child exited
+                epoll_ctl(epfd, EPOLL_CTL_DEL, job->pidfd, NULL);
+                batch_reap(job);
+            }
+            else if(output_drain(job->out_fd, &job->output) <= 0){
+                epoll_ctl(epfd, EPOLL_CTL_DEL, job->out_fd, NULL);
+                close(job->out_fd);
+                job->out_fd = -1;
+                if(job->pidfd < 0 && job->pid > 0){
+                    batch_reap(job);
+                }
+            }
+            // A command is done once it was reaped and its stdout reached end of file,
+            // each of the two happens once so this is only true after the second one
+            if(job->pid < 0 && job->out_fd < 0){
+                running--;
+                if(!WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) result = false;
+            }
+        }
+    }
+    close(epfd);
     return result;
 }
@@ -6,9 +6,54 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+/**
+ * How do_exec_argv() starts the child process
+ */
+enum exec_method
+{
+    EXEC_SPAWN, /* posix_spawn(), the default of do_exec() and do_exec_redirect() */
+    EXEC_FORK,  /* fork() then execv() */
+};
+
+/**
+ * Growable buffer receiving the output of a child process
+ */
+struct exec_output
+{
+    char *data;     /* malloc'ed and NUL terminated, NULL while nothing was read */
+    size_t len;     /* bytes of output in data */
+    size_t size;    /* bytes allocated for data */
+    size_t limit;   /* set by the caller: bytes kept at most, 0 for no limit */
+    bool truncated; /* output past limit was read and dropped */
+};
+
+/**
+ * One command of a do_exec_batch() call
+ */
+struct exec_job
+{
+    char *const *command;       /* in: NULL terminated argument vector, command[0] is a full path */
+    int status;                 /* out: waitpid() status, -1 if the command could not be started */
+    struct exec_output output;  /* out: everything the command wrote to stdout, free with free(output.data) */
+    double elapsed_sec;         /* out: wall clock time from start until the command was reaped */
+    /* used by do_exec_batch() while the command runs */
+    pid_t pid;
+    int pidfd;
+    int out_fd;
+    struct timespec start;
+};
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+bool do_exec_argv(enum exec_method method, const char *outputfile, char *const command[]);
+
+bool do_exec_capture(char *const command[], struct exec_output *out, struct exec_output *err);
+
+bool do_exec_batch(struct exec_job *jobs, size_t count, unsigned int max_parallel);
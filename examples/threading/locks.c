@@ -0,0 +1,201 @@
+#define _GNU_SOURCE /* PTHREAD_MUTEX_ADAPTIVE_NP */
+#include "locks.h"
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define SPIN_BEFORE_SLEEP 100
+
+static const char *lock_names[LOCK_KIND_COUNT] = {
+    [LOCK_MUTEX] = "mutex",
+    [LOCK_ADAPTIVE] = "adaptive",
+    [LOCK_SPIN] = "spinlock",
+    [LOCK_TICKET] = "ticket",
+    [LOCK_FUTEX] = "futex",
+};
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void ticket_lock(struct ticket_lock *lock)
+{
+    unsigned int ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+    while (atomic_load_explicit(&lock->serving, memory_order_acquire) != ticket)
+    {
+        cpu_relax();
+    }
+}
+
+static void ticket_unlock(struct ticket_lock *lock)
+{
+    atomic_store_explicit(&lock->serving, atomic_load_explicit(&lock->serving, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/**
+ * Mutex from Ulrich Drepper's "Futexes Are Tricky": 0 unlocked, 1 locked, 2 locked and
+ * possibly contended.  Unlock only enters the kernel when the state was 2.
+ */
+static void futex_lock(struct futex_lock *lock)
+{
+    int state = 0;
+    int i;
+
+    for (i = 0; i < SPIN_BEFORE_SLEEP; i++)
+    {
+        state = 0;
+        if (atomic_compare_exchange_weak_explicit(&lock->state, &state, 1, memory_order_acquire, memory_order_relaxed))
+        {
+            return;
+        }
+        cpu_relax();
+    }
+    if (state != 2)
+    {
+        state = atomic_exchange_explicit(&lock->state, 2, memory_order_acquire);
+    }
+    while (state != 0)
+    {
+        syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        state = atomic_exchange_explicit(&lock->state, 2, memory_order_acquire);
+    }
+}
+
+static void futex_unlock(struct futex_lock *lock)
+{
+    if (atomic_fetch_sub_explicit(&lock->state, 1, memory_order_release) != 1)
+    {
+        atomic_store_explicit(&lock->state, 0, memory_order_release);
+        syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Initialize @param lock as a lock of type @param kind
+ * @return true if successful
+ */
+bool any_lock_init(struct any_lock *lock, enum lock_kind kind)
+{
+    pthread_mutexattr_t attr;
+    bool result = true;
+
+    memset(lock, 0, sizeof(*lock));
+    lock->kind = kind;
+    switch (kind)
+    {
+    case LOCK_MUTEX:
+        result = pthread_mutex_init(&lock->mutex, NULL) == 0;
+        break;
+    case LOCK_ADAPTIVE:
+        if (pthread_mutexattr_init(&attr) != 0)
+        {
+            return false;
+        }
+        result = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP) == 0 &&
+                 pthread_mutex_init(&lock->mutex, &attr) == 0;
+        pthread_mutexattr_destroy(&attr);
+        break;
+    case LOCK_SPIN:
+        result = pthread_spin_init(&lock->spin, PTHREAD_PROCESS_PRIVATE) == 0;
+        break;
+    case LOCK_TICKET:
+    case LOCK_FUTEX:
+        break;
+    default:
+        result = false;
+        break;
+    }
+    return result;
+}
+
+void any_lock_lock(struct any_lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_lock(&lock->mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_lock(&lock->spin);
+        break;
+    case LOCK_TICKET:
+        ticket_lock(&lock->ticket);
+        break;
+    case LOCK_FUTEX:
+        futex_lock(&lock->futex);
+        break;
+    default:
+        break;
+    }
+}
+
+void any_lock_unlock(struct any_lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_unlock(&lock->mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_unlock(&lock->spin);
+        break;
+    case LOCK_TICKET:
+        ticket_unlock(&lock->ticket);
+        break;
+    case LOCK_FUTEX:
+        futex_unlock(&lock->futex);
+        break;
+    default:
+        break;
+    }
+}
+
+void any_lock_destroy(struct any_lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE:
+        pthread_mutex_destroy(&lock->mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_destroy(&lock->spin);
+        break;
+    default:
+        break;
+    }
+}
+
+const char *lock_kind_name(enum lock_kind kind)
+{
+    return kind < LOCK_KIND_COUNT ? lock_names[kind] : "unknown";
+}
+
+/**
+ * Look up the lock kind called @param name, as printed by lock_kind_name()
+ * @return true if @param kind was set
+ */
+bool lock_kind_parse(const char *name, enum lock_kind *kind)
+{
+    int i;
+
+    for (i = 0; i < LOCK_KIND_COUNT; i++)
+    {
+        if (strcmp(name, lock_names[i]) == 0)
+        {
+            *kind = i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,51 @@
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * Lock implementations compared by threading-bench, all used through struct any_lock
+ */
+enum lock_kind
+{
+    LOCK_MUTEX,    /* default pthread_mutex_t */
+    LOCK_ADAPTIVE, /* pthread_mutex_t of type PTHREAD_MUTEX_ADAPTIVE_NP, spins briefly before sleeping */
+    LOCK_SPIN,     /* pthread_spinlock_t, never sleeps */
+    LOCK_TICKET,   /* FIFO ticket lock, never sleeps */
+    LOCK_FUTEX,    /* three state futex lock, spins briefly then sleeps in the kernel */
+    LOCK_KIND_COUNT,
+};
+
+struct ticket_lock
+{
+    atomic_uint next;    /* ticket handed to the next thread calling lock */
+    atomic_uint serving; /* ticket allowed in the critical section */
+};
+
+struct futex_lock
+{
+    atomic_int state; /* 0 unlocked, 1 locked, 2 locked with waiters */
+};
+
+struct any_lock
+{
+    enum lock_kind kind;
+    union
+    {
+        pthread_mutex_t mutex;
+        pthread_spinlock_t spin;
+        struct ticket_lock ticket;
+        struct futex_lock futex;
+    };
+};
+
+bool any_lock_init(struct any_lock *lock, enum lock_kind kind);
+
+void any_lock_lock(struct any_lock *lock);
+
+void any_lock_unlock(struct any_lock *lock);
+
+void any_lock_destroy(struct any_lock *lock);
+
+const char *lock_kind_name(enum lock_kind kind);
+
+bool lock_kind_parse(const char *name, enum lock_kind *kind);
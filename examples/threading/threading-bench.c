@@ -0,0 +1,248 @@
+/**
+ * @file threading-bench.c
+ * @brief Lock contention benchmark following the cycle of start_thread_obtaining_mutex()
+ *
+ * Every thread repeats the threadfunc() cycle: wait, obtain the lock, hold it,
+ * release it.  The cycle runs in microseconds instead of milliseconds and the
+ * waits are busy loops, so it models a hot path rather than sleeping threads.
+ * The time spent in the lock call is recorded for every acquisition.  For each lock
+ * kind the benchmark prints one JSON object with the throughput and the latency
+ * percentiles.
+ *
+ * Usage: threading-bench [-t threads] [-H hold_us] [-w wait_us] [-d seconds] [-l lock[,lock...]]
+ *      lock is one of mutex, adaptive, spinlock, ticket, futex, all of them by default
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "locks.h"
+
+#define MAX_SAMPLES_PER_THREAD (1 << 18)
+
+struct bench_config
+{
+    int threads;
+    double hold_us;
+    double wait_us;
+    int seconds;
+};
+
+struct bench_thread
+{
+    pthread_t thread;
+    const struct bench_config *config;
+    struct any_lock *lock;
+    atomic_bool *stop;
+    uint64_t acquisitions;
+    uint64_t *samples; /* acquisition latency in ns, the first MAX_SAMPLES_PER_THREAD only */
+    size_t nsamples;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Busy wait for @param us microseconds, a thread waiting on a CPU bound critical section
+ * keeps its CPU like a request handler would
+ */
+static void spin_for(double us)
+{
+    uint64_t end;
+
+    if (us <= 0)
+    {
+        return;
+    }
+    end = now_ns() + (uint64_t)(us * 1000);
+    while (now_ns() < end)
+    {
+    }
+}
+
+void *bench_threadfunc(void *thread_param)
+{
+    struct bench_thread *data = (struct bench_thread *)thread_param;
+    uint64_t start;
+    uint64_t latency;
+
+    while (!atomic_load_explicit(data->stop, memory_order_relaxed))
+    {
+        spin_for(data->config->wait_us);
+        start = now_ns();
+        any_lock_lock(data->lock);
+        latency = now_ns() - start;
+        spin_for(data->config->hold_us);
+        any_lock_unlock(data->lock);
+
+        if (data->nsamples < MAX_SAMPLES_PER_THREAD)
+        {
+            data->samples[data->nsamples++] = latency;
+        }
+        data->acquisitions++;
+    }
+    return thread_param;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_bench(const struct bench_config *config, enum lock_kind kind, bool *first)
+{
+    struct bench_thread *threads = calloc(config->threads, sizeof(struct bench_thread));
+    uint64_t *all_samples;
+    struct any_lock lock;
+    atomic_bool stop;
+    uint64_t acquisitions = 0;
+    uint64_t start, end;
+    size_t nsamples = 0;
+    int started = 0;
+    int i;
+
+    if (threads == NULL || !any_lock_init(&lock, kind))
+    {
+        fprintf(stderr, "Could not set up lock %s\n", lock_kind_name(kind));
+        free(threads);
+        return 1;
+    }
+    atomic_init(&stop, false);
+
+    start = now_ns();
+    for (i = 0; i < config->threads; i++)
+    {
+        threads[i].config = config;
+        threads[i].lock = &lock;
+        threads[i].stop = &stop;
+        threads[i].samples = malloc(MAX_SAMPLES_PER_THREAD * sizeof(uint64_t));
+        if (threads[i].samples == NULL || pthread_create(&threads[i].thread, NULL, bench_threadfunc, &threads[i]) != 0)
+        {
+            fprintf(stderr, "Could not start thread %d\n", i);
+            free(threads[i].samples);
+            break;
+        }
+        started++;
+    }
+    sleep(config->seconds);
+    atomic_store(&stop, true);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        acquisitions += threads[i].acquisitions;
+        nsamples += threads[i].nsamples;
+    }
+    end = now_ns();
+    any_lock_destroy(&lock);
+
+    all_samples = malloc((nsamples ? nsamples : 1) * sizeof(uint64_t));
+    nsamples = 0;
+    for (i = 0; i < started; i++)
+    {
+        if (all_samples != NULL)
+        {
+            memcpy(&all_samples[nsamples], threads[i].samples, threads[i].nsamples * sizeof(uint64_t));
+            nsamples += threads[i].nsamples;
+        }
+        free(threads[i].samples);
+    }
+    free(threads);
+    if (all_samples == NULL || nsamples == 0)
+    {
+        free(all_samples);
+        return 1;
+    }
+    qsort(all_samples, nsamples, sizeof(uint64_t), compare_u64);
+
+    printf("%s  {\"lock\": \"%s\", \"threads\": %d, \"hold_us\": %g, \"wait_us\": %g, \"seconds\": %.3f, "
+           "\"acquisitions\": %llu, \"acquisitions_per_sec\": %.0f, "
+           "\"latency_ns\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+           *first ? "" : ",\n", lock_kind_name(kind), started, config->hold_us, config->wait_us,
+           (end - start) / 1e9, (unsigned long long)acquisitions, acquisitions / ((end - start) / 1e9),
+           (unsigned long long)all_samples[nsamples / 2],
+           (unsigned long long)all_samples[(size_t)(nsamples * 0.9)],
+           (unsigned long long)all_samples[(size_t)(nsamples * 0.99)],
+           (unsigned long long)all_samples[(size_t)(nsamples * 0.999)],
+           (unsigned long long)all_samples[nsamples - 1]);
+    free(all_samples);
+    *first = false;
+    return started == config->threads ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_config config = {
+        .threads = 4,
+        .hold_us = 1,
+        .wait_us = 1,
+        .seconds = 2,
+    };
+    bool selected[LOCK_KIND_COUNT];
+    bool any_selected = false;
+    bool first = true;
+    enum lock_kind kind;
+    char *name;
+    int opt;
+    int rc = 0;
+    int i;
+
+    memset(selected, 0, sizeof(selected));
+    while ((opt = getopt(argc, argv, "t:H:w:d:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'H':
+            config.hold_us = atof(optarg);
+            break;
+        case 'w':
+            config.wait_us = atof(optarg);
+            break;
+        case 'd':
+            config.seconds = atoi(optarg);
+            break;
+        case 'l':
+            for (name = strtok(optarg, ","); name != NULL; name = strtok(NULL, ","))
+            {
+                if (!lock_kind_parse(name, &kind))
+                {
+                    fprintf(stderr, "Unknown lock %s\n", name);
+                    return 1;
+                }
+                selected[kind] = true;
+                any_selected = true;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-H hold_us] [-w wait_us] [-d seconds] [-l lock[,lock...]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.threads < 1 || config.seconds < 1 || config.hold_us < 0 || config.wait_us < 0)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    printf("[\n");
+    for (i = 0; i < LOCK_KIND_COUNT; i++)
+    {
+        if (!any_selected || selected[i])
+        {
+            rc |= run_bench(&config, i, &first);
+        }
+    }
+    printf("\n]\n");
+    return rc;
+}
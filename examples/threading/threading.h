@@ -26,6 +26,12 @@ struct thread_data
     pthread_mutex_t *mutex;
 };
 
+/**
+ * Thread entry point run by start_thread_obtaining_mutex(), waits, obtains and releases the
+ * mutex described by @param thread_param, a struct thread_data, and returns it
+ */
+void *threadfunc(void *thread_param);
+
 /**
  * Start a thread which sleeps @param wait_to_obtain_ms number of milliseconds, then obtains the
  * mutex in @param mutex, then holds for @param wait_to_release_ms milliseconds, then releases.
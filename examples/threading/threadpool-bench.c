@@ -0,0 +1,140 @@
+/**
+ * @file threadpool-bench.c
+ * @brief Short task throughput of a thread pool against one pthread_create() per task
+ *
+ * Runs the same number of tiny tasks twice: once creating and joining a
+ * thread per task with a malloc'ed argument, the way start_thread_obtaining_mutex()
+ * does, and once through thread_pool_submit()/thread_task_wait() with up
+ * to -q tasks in flight.
+ *
+ * Usage: threadpool-bench [-n tasks] [-t pool_threads] [-q max_in_flight]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "threadpool.h"
+
+static double elapsed_sec(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void *short_task(void *arg)
+{
+    long *value = (long *)arg;
+    (*value)++;
+    return arg;
+}
+
+static int run_pthread(long tasks)
+{
+    struct timespec start, end;
+    pthread_t thread;
+    long sum = 0;
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < tasks; i++)
+    {
+        long *value = malloc(sizeof(long));
+        if (value == NULL)
+        {
+            return 1;
+        }
+        *value = i;
+        if (pthread_create(&thread, NULL, short_task, value) != 0)
+        {
+            free(value);
+            return 1;
+        }
+        pthread_join(thread, NULL);
+        sum += *value - i;
+        free(value);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("method=pthread_create tasks=%ld secs=%.3f tasks/s=%.0f ok=%d\n",
+           tasks, elapsed_sec(&start, &end), tasks / elapsed_sec(&start, &end), sum == tasks);
+    return sum == tasks ? 0 : 1;
+}
+
+static int run_pool(long tasks, int nthreads, uint32_t in_flight)
+{
+    struct thread_pool *pool = thread_pool_create(nthreads, in_flight);
+    struct thread_task **handles = calloc(in_flight, sizeof(struct thread_task *));
+    long *values = calloc(in_flight, sizeof(long));
+    struct timespec start, end;
+    long sum = 0;
+    long submitted = 0;
+    long waited = 0;
+
+    if (pool == NULL || handles == NULL || values == NULL)
+    {
+        fprintf(stderr, "Could not create the pool\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (waited < tasks)
+    {
+        // Keep in_flight tasks queued, waiting for the oldest one when the freelist is empty
+        while (submitted < tasks && submitted - waited < in_flight)
+        {
+            uint32_t slot = submitted % in_flight;
+            values[slot] = submitted;
+            handles[slot] = thread_pool_submit(pool, short_task, &values[slot]);
+            if (handles[slot] == NULL)
+            {
+                break;
+            }
+            submitted++;
+        }
+        uint32_t slot = waited % in_flight;
+        long *value = thread_task_wait(pool, handles[slot]);
+        sum += *value - waited;
+        waited++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("method=thread_pool threads=%d in_flight=%u tasks=%ld secs=%.3f tasks/s=%.0f ok=%d\n",
+           nthreads, in_flight, tasks, elapsed_sec(&start, &end), tasks / elapsed_sec(&start, &end), sum == tasks);
+    thread_pool_destroy(pool);
+    free(handles);
+    free(values);
+    return sum == tasks ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    long tasks = 100000;
+    int nthreads = 4;
+    uint32_t in_flight = 256;
+    int opt;
+    int rc = 0;
+
+    while ((opt = getopt(argc, argv, "n:t:q:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            tasks = atol(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'q':
+            in_flight = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n tasks] [-t pool_threads] [-q max_in_flight]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (tasks < 1 || nthreads < 1 || in_flight < 1)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+    rc |= run_pthread(tasks);
+    rc |= run_pool(tasks, nthreads, in_flight);
+    return rc;
+}
@@ -0,0 +1,219 @@
+#include "threadpool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define ERROR_LOG(msg, ...) printf("threadpool ERROR: " msg "\n", ##__VA_ARGS__)
+
+#define TASK_FREE 0
+#define TASK_QUEUED 1
+#define TASK_RUNNING 2
+#define TASK_DONE 3
+#define TASK_WAITER 4
+
+#define FREELIST_INDEX(head) ((uint32_t)(head))
+#define FREELIST_TAG(head) ((head) >> 32)
+
+static struct thread_task *freelist_pop(struct thread_pool *pool)
+{
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+    uint64_t new_head;
+    uint32_t index;
+
+    do
+    {
+        index = FREELIST_INDEX(head);
+        if (index == 0)
+        {
+            return NULL;
+        }
+        new_head = ((FREELIST_TAG(head) + 1) << 32) |
+                   atomic_load_explicit(&pool->tasks[index - 1].next_free, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, new_head,
+                                                    memory_order_acquire, memory_order_acquire));
+    return &pool->tasks[index - 1];
+}
+
+static void freelist_push(struct thread_pool *pool, struct thread_task *task)
+{
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+    uint64_t new_head;
+    uint32_t index = task - pool->tasks + 1;
+
+    do
+    {
+        atomic_store_explicit(&task->next_free, FREELIST_INDEX(head), memory_order_relaxed);
+        new_head = ((FREELIST_TAG(head) + 1) << 32) | index;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, new_head,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+void *workerfunc(void *thread_param)
+{
+    struct thread_pool *pool = (struct thread_pool *)thread_param;
+    struct thread_task *task;
+    unsigned int state;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queue_head == NULL && !pool->stopping)
+        {
+            pool->idle++;
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+            pool->idle--;
+        }
+        task = pool->queue_head;
+        if (task == NULL)
+        {
+            // Stopping and nothing left to run
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pool->queue_head = task->next;
+        if (pool->queue_head == NULL)
+        {
+            pool->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        atomic_fetch_add_explicit(&task->state, TASK_RUNNING - TASK_QUEUED, memory_order_relaxed);
+        task->result = task->fn(task->arg);
+        // Publish the result, only enter the kernel if somebody is sleeping on it
+        state = atomic_exchange_explicit(&task->state, TASK_DONE, memory_order_acq_rel);
+        if (state & TASK_WAITER)
+        {
+            syscall(SYS_futex, &task->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+        }
+    }
+    return thread_param;
+}
+
+struct thread_pool *thread_pool_create(int nthreads, uint32_t max_tasks)
+{
+    struct thread_pool *pool;
+    uint32_t i;
+
+    if (nthreads < 1 || max_tasks < 1)
+    {
+        return NULL;
+    }
+    pool = calloc(1, sizeof(struct thread_pool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->tasks = calloc(max_tasks, sizeof(struct thread_task));
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    if (pool->tasks == NULL || pool->threads == NULL)
+    {
+        free(pool->tasks);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pool->max_tasks = max_tasks;
+    // Chain every descriptor into the freelist, first one on top
+    for (i = 0; i < max_tasks; i++)
+    {
+        atomic_init(&pool->tasks[i].state, TASK_FREE);
+        atomic_init(&pool->tasks[i].next_free, i + 1 < max_tasks ? i + 2 : 0);
+    }
+    atomic_init(&pool->free_head, 1);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+
+    for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++)
+    {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, &workerfunc, pool) != 0)
+        {
+            ERROR_LOG("can't create worker thread %d", pool->nthreads);
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+struct thread_task *thread_pool_submit(struct thread_pool *pool, void *(*fn)(void *), void *arg)
+{
+    struct thread_task *task = freelist_pop(pool);
+
+    if (task == NULL)
+    {
+        return NULL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->result = NULL;
+    task->next = NULL;
+    atomic_store_explicit(&task->state, TASK_QUEUED, memory_order_relaxed);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->queue_tail)
+    {
+        pool->queue_tail->next = task;
+    }
+    else
+    {
+        pool->queue_head = task;
+    }
+    pool->queue_tail = task;
+    // Busy workers pick the task up on their next loop, only wake one if some are asleep
+    if (pool->idle)
+    {
+        pthread_cond_signal(&pool->work_available);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return task;
+}
+
+bool thread_task_done(struct thread_task *task)
+{
+    return atomic_load_explicit(&task->state, memory_order_acquire) == TASK_DONE;
+}
+
+void *thread_task_wait(struct thread_pool *pool, struct thread_task *task)
+{
+    unsigned int state = atomic_load_explicit(&task->state, memory_order_acquire);
+    void *result;
+
+    while (state != TASK_DONE)
+    {
+        // Tell the worker to wake us, then sleep until the state changes from what we set
+        if (!(state & TASK_WAITER) &&
+            !atomic_compare_exchange_weak_explicit(&task->state, &state, state | TASK_WAITER,
+                                                   memory_order_acquire, memory_order_acquire))
+        {
+            continue;
+        }
+        syscall(SYS_futex, &task->state, FUTEX_WAIT_PRIVATE, state | TASK_WAITER, NULL, NULL, 0);
+        state = atomic_load_explicit(&task->state, memory_order_acquire);
+    }
+    result = task->result;
+    atomic_store_explicit(&task->state, TASK_FREE, memory_order_relaxed);
+    freelist_push(pool, task);
+    return result;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->tasks);
+    free(pool);
+}
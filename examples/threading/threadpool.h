@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * A task submitted to a thread pool, also the handle used to wait for its result.
+ * Task descriptors are preallocated by thread_pool_create() and recycled through a
+ * lock-free freelist, so submitting a task never calls malloc.
+ */
+struct thread_task
+{
+    void *(*fn)(void *);
+    void *arg;
+    void *result;
+    /**
+     * TASK_* state, TASK_WAITER is or'ed in when a thread sleeps in thread_task_wait()
+     */
+    atomic_uint state;
+    /**
+     * Index + 1 of the next descriptor in the freelist, 0 at its end
+     */
+    atomic_uint next_free;
+    /**
+     * Next task in the pool's run queue
+     */
+    struct thread_task *next;
+};
+
+struct thread_pool
+{
+    struct thread_task *tasks;
+    uint32_t max_tasks;
+    /**
+     * Freelist head: index + 1 of the first free descriptor in the low 32 bits, 0 when the
+     * list is empty, and a counter bumped on every change in the high 32 bits so a pop racing
+     * with a pop and push of the same descriptor fails its compare and swap (ABA)
+     */
+    _Atomic uint64_t free_head;
+
+    pthread_mutex_t lock;           /* guards the run queue, idle and stopping */
+    pthread_cond_t work_available;
+    struct thread_task *queue_head;
+    struct thread_task *queue_tail;
+    int idle;
+    bool stopping;
+
+    pthread_t *threads;
+    int nthreads;
+};
+
+/**
+ * Start @param nthreads worker threads, able to hold @param max_tasks submitted tasks which
+ * were not waited for yet.
+ * @return the pool, or NULL if it could not be created
+ */
+struct thread_pool *thread_pool_create(int nthreads, uint32_t max_tasks);
+
+/**
+ * Queue @param fn to be called with @param arg by one of the workers of @param pool.
+ * Does not block and does not allocate memory.
+ * @return the task handle, which must be passed to thread_task_wait() exactly once, or NULL
+ * if all max_tasks descriptors are in use
+ */
+struct thread_task *thread_pool_submit(struct thread_pool *pool, void *(*fn)(void *), void *arg);
+
+/**
+ * @return true if @param task has completed, thread_task_wait() will then not block
+ */
+bool thread_task_done(struct thread_task *task);
+
+/**
+ * Block until @param task of @param pool has completed, then return its descriptor to the
+ * freelist.
+ * @return the value returned by the task function
+ */
+void *thread_task_wait(struct thread_pool *pool, struct thread_task *task);
+
+/**
+ * Run the tasks still queued, stop the workers and free @param pool.  Tasks which were not
+ * waited for are lost.
+ */
+void thread_pool_destroy(struct thread_pool *pool);
@@ -0,0 +1,151 @@
+#!/bin/sh
+# Scaling benchmark companion of finder-test.sh
+# For every number of files, writes a corpus with writer's bulk mode, times writer, finder and
+# a plain grep -rc over it, checks finder against the expected counts and prints a CSV line.
+#
+# Usage: finder-scale-test.sh [-n "1000 10000 ..."] [-s bytes_per_file] [-m match_every]
+#                             [-w writestr] [-d dir] [-j threads] [-o csv_file]
+#   -n  numbers of files to test, default "1000 10000 100000 1000000"
+#   -s  approximate size of every file in bytes, default 256
+#   -m  one line out of match_every holds writestr, default 10
+#   -j  writer and finder threads, default the number of CPUs
+#   -o  also append the CSV lines to csv_file
+#
+# writer and finder are taken next to this script when built there, else from /usr/bin.
+
+set -e
+set -u
+
+SCALES="1000 10000 100000 1000000"
+FILESIZE=256
+MATCHEVERY=10
+WRITESTR=AELD_IS_FUN
+WRITEDIR=/tmp/aeld-scale-data
+THREADS=$(getconf _NPROCESSORS_ONLN)
+CSVFILE=""
+LINELEN=64
+
+while getopts "n:s:m:w:d:j:o:" opt
+do
+	case $opt in
+	n) SCALES=$OPTARG ;;
+	s) FILESIZE=$OPTARG ;;
+	m) MATCHEVERY=$OPTARG ;;
+	w) WRITESTR=$OPTARG ;;
+	d) WRITEDIR=$OPTARG ;;
+	j) THREADS=$OPTARG ;;
+	o) CSVFILE=$OPTARG ;;
+	*)
+		echo "Usage example: finder-scale-test.sh -n \"1000 10000\" -s 256 -m 10 -o results.csv"
+		exit 1
+		;;
+	esac
+done
+
+SCRIPTDIR=$(dirname "$0")
+if [ -x "$SCRIPTDIR/writer" ] && [ -x "$SCRIPTDIR/finder" ]
+then
+	WRITER=$SCRIPTDIR/writer
+	FINDER=$SCRIPTDIR/finder
+else
+	WRITER=/usr/bin/writer
+	FINDER=/usr/bin/finder
+fi
+
+now()
+{
+	date +%s.%N
+}
+
+elapsed()
+{
+	echo "$1 $2" | awk '{ printf "%.3f", $2 - $1 }'
+}
+
+# Print the manifest of $1 files of about FILESIZE bytes in lines of LINELEN bytes, every
+# MATCHEVERY-th line of the corpus holding WRITESTR, 1000 files per directory.  The expected
+# number of matching files and lines is written to $2.
+manifest()
+{
+	awk -v files="$1" -v size="$FILESIZE" -v every="$MATCHEVERY" -v str="$WRITESTR" \
+		-v linelen="$LINELEN" -v expected="$2" '
+	BEGIN {
+		filler = ""
+		while (length(filler) < linelen - 1)
+			filler = filler "x"
+		hit = substr(filler, 1, int((linelen - 1 - length(str)) / 2)) str
+		hit = hit substr(filler, 1, linelen - 1 - length(hit))
+		lines = int(size / linelen)
+		if (lines < 1)
+			lines = 1
+		matching_files = 0
+		matching_lines = 0
+		n = 0
+		for (i = 1; i <= files; i++) {
+			content = ""
+			found = 0
+			for (l = 0; l < lines; l++) {
+				if (n++ % every == 0) {
+					content = content hit "\\n"
+					found++
+				} else {
+					content = content filler "\\n"
+				}
+			}
+			if (found) {
+				matching_files++
+				matching_lines += found
+			}
+			printf "d%d/f%d.txt\t%s\n", int(i / 1000), i, content
+		}
+		printf "%d %d\n", matching_files, matching_lines > expected
+	}'
+}
+
+echo "files,bytes_per_file,match_every,threads,writer_sec,finder_sec,grep_sec,matching_files,matching_lines,result"
+if [ -n "$CSVFILE" ] && [ ! -s "$CSVFILE" ]
+then
+	echo "files,bytes_per_file,match_every,threads,writer_sec,finder_sec,grep_sec,matching_files,matching_lines,result" > "$CSVFILE"
+fi
+
+STATUS=0
+for NUMFILES in $SCALES
+do
+	rm -rf "$WRITEDIR"
+	mkdir -p "$WRITEDIR"
+	manifest "$NUMFILES" "$WRITEDIR.expected" > "$WRITEDIR.manifest"
+	EXPECTED=$(cat "$WRITEDIR.expected")
+	MATCHSTR="The number of files are ${EXPECTED% *} and the number of matching lines are ${EXPECTED#* }"
+
+	START=$(now)
+	"$WRITER" -b -d "$WRITEDIR" -j "$THREADS" "$WRITEDIR.manifest"
+	WRITERSEC=$(elapsed "$START" "$(now)")
+
+	START=$(now)
+	OUTPUTSTRING=$("$FINDER" -j "$THREADS" "$WRITEDIR" "$WRITESTR")
+	FINDERSEC=$(elapsed "$START" "$(now)")
+
+	START=$(now)
+	grep -rc "$WRITESTR" "$WRITEDIR" > /dev/null || true
+	GREPSEC=$(elapsed "$START" "$(now)")
+
+	# The whole line must match, a count with extra digits is a failure
+	if [ "$OUTPUTSTRING" = "$MATCHSTR" ]
+	then
+		RESULT=ok
+	else
+		RESULT=failed
+		STATUS=1
+		echo "failed: expected ${MATCHSTR} but found ${OUTPUTSTRING}" >&2
+	fi
+	LINE="$NUMFILES,$FILESIZE,$MATCHEVERY,$THREADS,$WRITERSEC,$FINDERSEC,$GREPSEC,${EXPECTED% *},${EXPECTED#* },$RESULT"
+	echo "$LINE"
+	if [ -n "$CSVFILE" ]
+	then
+		echo "$LINE" >> "$CSVFILE"
+	fi
+done
+
+# remove temporary directories
+rm -rf "$WRITEDIR" "$WRITEDIR.manifest" "$WRITEDIR.expected"
+exit $STATUS
@@ -0,0 +1,423 @@
+/**
+ * @file finder.c
+ * @brief Native replacement for finder.sh: counts the files under a directory holding a string
+ * and the lines matching it
+ *
+ * Usage: finder [-j threads] filesdir searchstr
+ *
+ * The directory tree is walked by a pool of threads.  Every thread owns a deque of directories
+ * and files to scan, pushes what it discovers on its own deque and takes work from the back of
+ * it, and steals from the front of the other deques once its own is empty.  Small files are
+ * read, bigger ones mapped, and scanned with the scan library.  The output line is the one of
+ * finder.sh, also written to /tmp/assignment4-result.txt.  Like grep -r, symbolic links below
+ * filesdir are not followed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../scan/scan.h"
+
+#define RESULT_FILE "/tmp/assignment4-result.txt"
+#define SMALL_FILE_SIZE (64 * 1024)
+
+struct work_item
+{
+    char *path;
+    bool is_dir;
+};
+
+/**
+ * Work queue of one thread.  The owner pushes and pops at the back, so it goes depth first
+ * through the tree it discovered, thieves take from the front where the oldest and usually
+ * biggest subtrees are.
+ */
+struct work_deque
+{
+    pthread_mutex_t lock;
+    struct work_item *items;
+    size_t head; /* first item, where thieves steal */
+    size_t tail; /* one past the last item, where the owner pushes and pops */
+    size_t capacity;
+};
+
+struct finder
+{
+    const char *needle;
+    size_t needle_len;
+    int nthreads;
+    struct work_deque *deques;
+    /**
+     * Items pushed and not completely processed yet, the walk is over when it drops to 0
+     */
+    atomic_size_t pending;
+};
+
+struct finder_thread
+{
+    pthread_t thread;
+    struct finder *finder;
+    int index;
+    uint64_t matching_files;
+    uint64_t matching_lines;
+    char *read_buf; /* SMALL_FILE_SIZE bytes */
+};
+
+static bool deque_push(struct work_deque *deque, struct work_item item)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity)
+    {
+        // Slide the live items to the front before growing
+        size_t count = deque->tail - deque->head;
+        if (deque->head > 0)
+        {
+            memmove(deque->items, &deque->items[deque->head], count * sizeof(struct work_item));
+            deque->head = 0;
+            deque->tail = count;
+        }
+        if (deque->tail == deque->capacity)
+        {
+            size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+            struct work_item *items = realloc(deque->items, capacity * sizeof(struct work_item));
+            if (items == NULL)
+            {
+                pthread_mutex_unlock(&deque->lock);
+                return false;
+            }
+            deque->items = items;
+            deque->capacity = capacity;
+        }
+    }
+    deque->items[deque->tail++] = item;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static bool deque_pop(struct work_deque *deque, struct work_item *item)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head)
+    {
+        *item = deque->items[--deque->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_steal(struct work_deque *deque, struct work_item *item)
+{
+    bool found = false;
+
+    // Do not wait behind the owner, another victim may have work
+    if (pthread_mutex_trylock(&deque->lock) != 0)
+    {
+        return false;
+    }
+    if (deque->tail > deque->head)
+    {
+        *item = deque->items[deque->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void push_work(struct finder *finder, int index, char *path, bool is_dir)
+{
+    struct work_item item = {.path = path, .is_dir = is_dir};
+
+    atomic_fetch_add(&finder->pending, 1);
+    if (!deque_push(&finder->deques[index], item))
+    {
+        syslog(LOG_ERR, "Out of memory queueing %s", path);
+        free(path);
+        atomic_fetch_sub(&finder->pending, 1);
+    }
+}
+
+static void count_matches(struct finder_thread *data, const char *buf, size_t len)
+{
+    size_t lines = scan_count_matching_lines(buf, len, data->finder->needle, data->finder->needle_len);
+
+    if (lines)
+    {
+        data->matching_files++;
+        data->matching_lines += lines;
+    }
+}
+
+static void scan_file(struct finder_thread *data, const char *path)
+{
+    struct stat st;
+    size_t len = 0;
+    ssize_t rc;
+    void *map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        syslog(LOG_ERR, "Cannot open file: %s", path);
+        return;
+    }
+    // Small files are cheaper to read than to map and unmap, only map when the buffer fills up
+    while (len < SMALL_FILE_SIZE && (rc = read(fd, data->read_buf + len, SMALL_FILE_SIZE - len)) != 0)
+    {
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            syslog(LOG_ERR, "Cannot read file: %s", path);
+            close(fd);
+            return;
+        }
+        len += rc;
+    }
+    if (len < SMALL_FILE_SIZE)
+    {
+        close(fd);
+        count_matches(data, data->read_buf, len);
+        return;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        syslog(LOG_ERR, "Cannot map file: %s", path);
+        return;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    count_matches(data, map, st.st_size);
+    munmap(map, st.st_size);
+}
+
+static void scan_dir(struct finder_thread *data, const char *path)
+{
+    struct dirent *entry;
+    struct stat st;
+    size_t path_len = strlen(path);
+    bool is_dir;
+    char *child;
+    DIR *dir = opendir(path);
+
+    if (dir == NULL)
+    {
+        syslog(LOG_ERR, "Cannot open directory: %s", path);
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        if (entry->d_type == DT_DIR || entry->d_type == DT_REG)
+        {
+            is_dir = entry->d_type == DT_DIR;
+        }
+        else if (entry->d_type == DT_UNKNOWN &&
+                 fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                 (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)))
+        {
+            is_dir = S_ISDIR(st.st_mode);
+        }
+        else
+        {
+            continue;
+        }
+        child = malloc(path_len + strlen(entry->d_name) + 2);
+        if (child == NULL)
+        {
+            syslog(LOG_ERR, "Out of memory walking %s", path);
+            break;
+        }
+        sprintf(child, "%s/%s", path, entry->d_name);
+        push_work(data->finder, data->index, child, is_dir);
+    }
+    closedir(dir);
+}
+
+void *finder_threadfunc(void *thread_param)
+{
+    struct finder_thread *data = (struct finder_thread *)thread_param;
+    struct finder *finder = data->finder;
+    struct work_item item;
+    bool found;
+    int idle = 0;
+    int i;
+
+    while (atomic_load(&finder->pending) > 0)
+    {
+        found = deque_pop(&finder->deques[data->index], &item);
+        for (i = 1; !found && i < finder->nthreads; i++)
+        {
+            found = deque_steal(&finder->deques[(data->index + i) % finder->nthreads], &item);
+        }
+        if (!found)
+        {
+            // Others are still scanning and may push more work
+            if (++idle > 64)
+            {
+                usleep(50);
+            }
+            else
+            {
+                sched_yield();
+            }
+            continue;
+        }
+        idle = 0;
+        if (item.is_dir)
+        {
+            scan_dir(data, item.path);
+        }
+        else
+        {
+            scan_file(data, item.path);
+        }
+        free(item.path);
+        atomic_fetch_sub(&finder->pending, 1);
+    }
+    return thread_param;
+}
+
+int main(int argc, char *argv[])
+{
+    struct finder finder = {0};
+    struct finder_thread *threads;
+    uint64_t matching_files = 0;
+    uint64_t matching_lines = 0;
+    struct stat st;
+    char *root;
+    FILE *result;
+    int started = 0;
+    int opt;
+    int i;
+
+    openlog(NULL, 0, LOG_USER);
+    finder.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            finder.nthreads = atoi(optarg);
+            break;
+        default:
+            printf("Usage example: finder [-j threads] filesdir searchstr\n");
+            return 1;
+        }
+    }
+    if (argc - optind < 2 || finder.nthreads < 1)
+    {
+        printf("Incorrect Number of arguments\n");
+        printf("Usage example: finder [-j threads] filesdir searchstr\n");
+        return 1;
+    }
+    if (stat(argv[optind], &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        printf("%s is not a directory\n", argv[optind]);
+        return 1;
+    }
+    finder.needle = argv[optind + 1];
+    finder.needle_len = strlen(finder.needle);
+
+    finder.deques = calloc(finder.nthreads, sizeof(struct work_deque));
+    threads = calloc(finder.nthreads, sizeof(struct finder_thread));
+    root = strdup(argv[optind]);
+    if (finder.deques == NULL || threads == NULL || root == NULL)
+    {
+        syslog(LOG_ERR, "Out of memory");
+        return 1;
+    }
+    for (i = 0; i < finder.nthreads; i++)
+    {
+        pthread_mutex_init(&finder.deques[i].lock, NULL);
+    }
+    atomic_init(&finder.pending, 0);
+    push_work(&finder, 0, root, true);
+
+    for (i = 0; i < finder.nthreads; i++)
+    {
+        threads[i].read_buf = malloc(SMALL_FILE_SIZE);
+        if (threads[i].read_buf == NULL)
+        {
+            syslog(LOG_ERR, "Out of memory");
+            return 1;
+        }
+    }
+    for (i = 0; i < finder.nthreads; i++)
+    {
+        threads[i].finder = &finder;
+        threads[i].index = i;
+        if (pthread_create(&threads[i].thread, NULL, finder_threadfunc, &threads[i]) != 0)
+        {
+            syslog(LOG_ERR, "Cannot create thread %d", i);
+            break;
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        // Scan from this thread, the deque of thread 0 holds the root
+        threads[0].finder = &finder;
+        finder.nthreads = 1;
+        finder_threadfunc(&threads[0]);
+        started = 1;
+    }
+    else
+    {
+        // Threads that failed to start leave their empty deques to be probed by the others
+        for (i = 0; i < started; i++)
+        {
+            pthread_join(threads[i].thread, NULL);
+        }
+    }
+    for (i = 0; i < started; i++)
+    {
+        matching_files += threads[i].matching_files;
+        matching_lines += threads[i].matching_lines;
+    }
+
+    result = fopen(RESULT_FILE, "w");
+    if (result != NULL)
+    {
+        fprintf(result, "The number of files are %llu and the number of matching lines are %llu\n",
+                (unsigned long long)matching_files, (unsigned long long)matching_lines);
+        fclose(result);
+    }
+    printf("The number of files are %llu and the number of matching lines are %llu\n",
+           (unsigned long long)matching_files, (unsigned long long)matching_lines);
+
+    for (i = 0; i < finder.nthreads; i++)
+    {
+        free(finder.deques[i].items);
+        free(threads[i].read_buf);
+        pthread_mutex_destroy(&finder.deques[i].lock);
+    }
+    free(finder.deques);
+    free(threads);
+    return 0;
+}
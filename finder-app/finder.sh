@@ -20,7 +20,14 @@ else
 	fi
 fi
 
-output=$(grep -rch "$SEARCHSTR" $FILESDIR | grep -v 0)
+# Prefer the native finder when it is installed next to this script
+if [ -x "$(dirname "$0")/finder" ]
+then
+	exec "$(dirname "$0")/finder" "$FILESDIR" "$SEARCHSTR"
+fi
+
+# Drop the files without any match, not every count containing a 0 digit
+output=$(grep -rch "$SEARCHSTR" $FILESDIR | grep -v '^0$')
 
 NOOFFILES=$(echo $output | wc -w)
 NOOFMATCHINGLINES=$(echo $output | sed 's/ /+/g' | bc)
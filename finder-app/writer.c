@@ -1,29 +1,409 @@
+#define _GNU_SOURCE /* memrchr() */
 #include "stdio.h"
 #include "syslog.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../examples/threading/threadpool.h"
+#include "../scan/scan.h"
+
+/*
+ * Usage: writer writefile writestr
+ *        writer -b [-d dir] [-j threads] [-p] [manifest]
+ *
+ * The bulk mode (-b) creates all the files of a manifest from one process instead of one
+ * writer process per file.  Every manifest line is "path<TAB>content", content being written
+ * like writestr, without a trailing newline, after replacing the escapes \n, \t and \\.  Paths
+ * are relative to -d (default the current directory), missing parent directories are created.
+ * The manifest is read from the file given or from stdin, in chunks which worker threads of a
+ * thread pool turn into files.  -p preallocates every file with fallocate() before writing it.
+ */
+
+#define CHUNK_SIZE (1024 * 1024)
+
+struct bulk_options
+{
+    int dirfd;
+    bool preallocate;
+};
+
+/**
+ * A run of complete manifest lines, handed to a worker thread
+ */
+struct bulk_chunk
+{
+    const struct bulk_options *options;
+    char *data;
+    size_t len;
+    size_t written;
+    size_t failed;
+};
+
+/**
+ * Copy @param len bytes of @param src to @param dst, replacing the \n, \t and \\ escapes
+ * @return the number of bytes stored in @param dst, at most @param len
+ */
+static size_t unescape(char *dst, const char *src, size_t len)
+{
+    size_t out = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (src[i] == '\\' && i + 1 < len)
+        {
+            switch (src[i + 1])
+            {
+            case 'n':
+                dst[out++] = '\n';
+                i++;
+                continue;
+            case 't':
+                dst[out++] = '\t';
+                i++;
+                continue;
+            case '\\':
+                dst[out++] = '\\';
+                i++;
+                continue;
+            }
+        }
+        dst[out++] = src[i];
+    }
+    return out;
+}
+
+/**
+ * Create the missing parent directories of @param path, relative to @param dirfd
+ */
+static void make_parents(int dirfd, char *path)
+{
+    char *slash;
+
+    for (slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        // Another worker may create the same directory at the same time
+        if (mkdirat(dirfd, path, 0755) != 0 && errno != EEXIST)
+        {
+            syslog(LOG_ERR, "Cannot create directory: %s", path);
+        }
+        *slash = '/';
+    }
+}
+
+static bool write_record(const struct bulk_options *options, const char *line, size_t len, char *content)
+{
+    char path[PATH_MAX];
+    const char *tab = memchr(line, '\t', len);
+    size_t path_len = tab ? (size_t)(tab - line) : len;
+    size_t content_len = tab ? unescape(content, tab + 1, len - path_len - 1) : 0;
+    size_t done = 0;
+    ssize_t rc;
+    int fd;
+
+    if (path_len == 0 || path_len >= sizeof(path))
+    {
+        syslog(LOG_ERR, "Invalid manifest path of %zu bytes", path_len);
+        return false;
+    }
+    memcpy(path, line, path_len);
+    path[path_len] = '\0';
+
+    fd = openat(options->dirfd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && strchr(path + 1, '/') != NULL)
+    {
+        make_parents(options->dirfd, path);
+        fd = openat(options->dirfd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0)
+    {
+        syslog(LOG_ERR, "Cannot open file: %s", path);
+        return false;
+    }
+    // Preallocation is only a hint, file systems without fallocate() still get the data
+    if (options->preallocate && content_len > 0 && fallocate(fd, 0, 0, content_len) != 0 &&
+        errno != EOPNOTSUPP)
+    {
+        syslog(LOG_ERR, "Cannot preallocate %zu bytes for %s", content_len, path);
+    }
+    while (done < content_len)
+    {
+        rc = write(fd, content + done, content_len - done);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            syslog(LOG_ERR, "Cannot write file: %s", path);
+            close(fd);
+            return false;
+        }
+        done += rc;
+    }
+    if (close(fd) != 0)
+    {
+        syslog(LOG_ERR, "Cannot close file: %s", path);
+        return false;
+    }
+    return true;
+}
+
+void *write_chunk(void *thread_param)
+{
+    struct bulk_chunk *chunk = (struct bulk_chunk *)thread_param;
+    const char *line = chunk->data;
+    const char *end = chunk->data + chunk->len;
+    const char *line_end;
+    char *content = malloc(chunk->len);
+
+    if (content == NULL)
+    {
+        syslog(LOG_ERR, "Out of memory writing a manifest chunk");
+        chunk->failed++;
+        return thread_param;
+    }
+    while (line < end)
+    {
+        line_end = scan_newline(line, end - line);
+        if (line_end == NULL)
+        {
+            line_end = end;
+        }
+        if (line_end > line)
+        {
+            if (write_record(chunk->options, line, line_end - line, content))
+            {
+                chunk->written++;
+            }
+            else
+            {
+                chunk->failed++;
+            }
+        }
+        line = line_end + 1;
+    }
+    free(content);
+    return thread_param;
+}
+
+/**
+ * Add the counts of @param chunk to @param written and @param failed, then free it
+ */
+static void account_chunk(struct bulk_chunk *chunk, size_t *written, size_t *failed)
+{
+    *written += chunk->written;
+    *failed += chunk->failed;
+    free(chunk->data);
+    free(chunk);
+}
+
+static int write_bulk(const char *manifest, const char *dir, int nthreads, bool preallocate)
+{
+    struct bulk_options options = {.dirfd = -1, .preallocate = preallocate};
+    uint32_t in_flight = 2 * nthreads;
+    struct thread_task **tasks = NULL;
+    struct thread_pool *pool = NULL;
+    struct bulk_chunk *chunk;
+    size_t submitted = 0;
+    size_t waited = 0;
+    size_t written = 0;
+    size_t failed = 0;
+    char *buf = NULL;
+    char *bigger;
+    size_t len = 0;
+    size_t capacity = 0;
+    bool eof = false;
+    ssize_t rc;
+    int fd = -1;
+
+    tasks = calloc(in_flight, sizeof(struct thread_task *));
+    pool = thread_pool_create(nthreads, in_flight);
+    if (tasks == NULL || pool == NULL)
+    {
+        syslog(LOG_ERR, "Cannot start %d writer threads", nthreads);
+        failed++;
+        goto out;
+    }
+    options.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (options.dirfd < 0)
+    {
+        syslog(LOG_ERR, "Cannot open directory: %s", dir);
+        failed++;
+        goto out;
+    }
+    fd = manifest ? open(manifest, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (fd < 0)
+    {
+        syslog(LOG_ERR, "Cannot open manifest: %s", manifest);
+        failed++;
+        goto out;
+    }
+
+    while (!eof || len > 0)
+    {
+        if (len == capacity)
+        {
+            // A line longer than a chunk grows the buffer until it fits
+            capacity = capacity ? capacity * 2 : CHUNK_SIZE;
+            bigger = realloc(buf, capacity);
+            if (bigger == NULL)
+            {
+                syslog(LOG_ERR, "Out of memory reading the manifest");
+                failed++;
+                break;
+            }
+            buf = bigger;
+        }
+        if (!eof)
+        {
+            rc = read(fd, buf + len, capacity - len);
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (rc < 0)
+            {
+                syslog(LOG_ERR, "Cannot read manifest");
+                failed++;
+            }
+            eof = rc <= 0;
+            len += rc > 0 ? rc : 0;
+            if (!eof && len < capacity)
+            {
+                continue;
+            }
+        }
+
+        // Hand the complete lines over, the last partial one starts the next chunk
+        const char *last_newline = eof ? buf + len - 1 : memrchr(buf, '\n', len);
+        if (last_newline == NULL)
+        {
+            continue;
+        }
+        chunk = calloc(1, sizeof(struct bulk_chunk));
+        char *rest = malloc(capacity);
+        if (chunk == NULL || rest == NULL)
+        {
+            syslog(LOG_ERR, "Out of memory reading the manifest");
+            free(chunk);
+            free(rest);
+            failed++;
+            break;
+        }
+        chunk->options = &options;
+        chunk->data = buf;
+        chunk->len = last_newline - buf + 1;
+        memcpy(rest, last_newline + 1, len - chunk->len);
+        len -= chunk->len;
+        buf = rest;
+
+        // Keep in_flight chunks queued, waiting for the oldest one when all are taken
+        if (submitted - waited == in_flight)
+        {
+            account_chunk(thread_task_wait(pool, tasks[waited++ % in_flight]), &written, &failed);
+        }
+        tasks[submitted % in_flight] = thread_pool_submit(pool, write_chunk, chunk);
+        if (tasks[submitted % in_flight] == NULL)
+        {
+            // No descriptor left, which the bound above should prevent: write it from here
+            syslog(LOG_ERR, "Cannot queue a manifest chunk, writing it inline");
+            account_chunk(write_chunk(chunk), &written, &failed);
+            continue;
+        }
+        submitted++;
+    }
+
+out:
+    while (waited < submitted)
+    {
+        account_chunk(thread_task_wait(pool, tasks[waited++ % in_flight]), &written, &failed);
+    }
+    if (pool != NULL)
+    {
+        thread_pool_destroy(pool);
+    }
+    free(tasks);
+    free(buf);
+    if (manifest && fd >= 0)
+    {
+        close(fd);
+    }
+    if (options.dirfd >= 0)
+    {
+        close(options.dirfd);
+    }
+
+    syslog(LOG_DEBUG, "Wrote %zu files in %s, %zu failed", written, dir, failed);
+    return failed ? 1 : 0;
+}
 
 int main(int argc, char *argv[])
 {
     openlog(NULL, 0, LOG_USER);
-    if (argc < 3)
+    bool bulk = false;
+    bool preallocate = false;
+    const char *dir = ".";
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    // '+' stops at the first operand, so a writestr starting with '-' is not taken for options
+    while ((opt = getopt(argc, argv, "+bd:j:p")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            bulk = true;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 'p':
+            preallocate = true;
+            break;
+        default:
+            syslog(LOG_ERR, "Usage: writer writefile writestr | writer -b [-d dir] [-j threads] [-p] [manifest]");
+            return 1;
+        }
+    }
+    if (bulk)
+    {
+        if (nthreads < 1)
+        {
+            syslog(LOG_ERR, "Invalid number of threads: %d", nthreads);
+            return 1;
+        }
+        return write_bulk(optind < argc ? argv[optind] : NULL, dir, nthreads, preallocate);
+    }
+
+    if (argc - optind < 2)
     {
         syslog(LOG_ERR, "Incorrect Number of arguments: %d", argc);
         return 1;
     }
     else
     {
-        const char *filename = argv[1];
+        const char *filename = argv[optind];
         FILE *file = fopen(filename, "w+");
         if (file == NULL)
         {
-            syslog(LOG_ERR, "Cannot open file: %s", argv[1]);
+            syslog(LOG_ERR, "Cannot open file: %s", filename);
             return 1;
         }
         else
         {
-            syslog(LOG_DEBUG, "Writing %s to %s", argv[2], argv[1]);
-            fputs(argv[2], file);
+            syslog(LOG_DEBUG, "Writing %s to %s", argv[optind + 1], filename);
+            fputs(argv[optind + 1], file);
             fclose(file);
         }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,226 @@
+/**
+ * @file scan-bench.c
+ * @brief Throughput of every scan implementation supported by the CPU, against glibc
+ *
+ * Fills a buffer with text lines, the search string being planted in one line out of -m, then
+ * for each implementation times walking the lines with scan_newline(), scan_count_newlines()
+ * and scan_count_matching_lines().  The glibc row does the same with memchr() and memmem().
+ * Results which differ from the scalar ones are reported and make the exit status 1.
+ *
+ * Usage: scan-bench [-s size_mb] [-l line_len] [-m match_every] [-n iterations] [-p pattern]
+ */
+
+#define _GNU_SOURCE /* memmem() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "scan.h"
+
+struct bench_result
+{
+    size_t lines;
+    size_t newlines;
+    size_t matching;
+    double secs[3];
+};
+
+static double elapsed_sec(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static size_t walk_lines(const char *buf, size_t len, bool use_libc)
+{
+    const char *end = buf + len;
+    const char *newline;
+    size_t lines = 0;
+
+    for (;;)
+    {
+        newline = use_libc ? memchr(buf, '\n', end - buf) : scan_newline(buf, end - buf);
+        if (newline == NULL)
+        {
+            return lines;
+        }
+        lines++;
+        buf = newline + 1;
+    }
+}
+
+static size_t count_newlines_libc(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    size_t count = 0;
+
+    while ((buf = memchr(buf, '\n', end - buf)) != NULL)
+    {
+        count++;
+        buf++;
+    }
+    return count;
+}
+
+static size_t count_matching_libc(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    const char *end = buf + len;
+    const char *match;
+    size_t lines = 0;
+
+    while ((match = memmem(buf, end - buf, needle, needle_len)) != NULL)
+    {
+        lines++;
+        buf = memchr(match, '\n', end - match);
+        if (buf == NULL)
+        {
+            break;
+        }
+        buf++;
+    }
+    return lines;
+}
+
+static void run(const char *buf, size_t len, const char *pattern, int iterations, bool use_libc,
+                struct bench_result *result)
+{
+    struct timespec start, end;
+    size_t pattern_len = strlen(pattern);
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++)
+    {
+        result->lines = walk_lines(buf, len, use_libc);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->secs[0] = elapsed_sec(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++)
+    {
+        result->newlines = use_libc ? count_newlines_libc(buf, len) : scan_count_newlines(buf, len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->secs[1] = elapsed_sec(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++)
+    {
+        result->matching = use_libc ? count_matching_libc(buf, len, pattern, pattern_len)
+                                    : scan_count_matching_lines(buf, len, pattern, pattern_len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->secs[2] = elapsed_sec(&start, &end);
+}
+
+static void print_result(const char *name, size_t len, int iterations, const struct bench_result *result,
+                         const struct bench_result *reference)
+{
+    double mb = (double)len * iterations / (1024 * 1024);
+    bool ok = reference == NULL || (result->lines == reference->lines && result->newlines == reference->newlines &&
+                                    result->matching == reference->matching);
+
+    printf("impl=%s newline_MB/s=%.0f count_MB/s=%.0f match_MB/s=%.0f lines=%zu matching=%zu ok=%d\n",
+           name, mb / result->secs[0], mb / result->secs[1], mb / result->secs[2],
+           result->newlines, result->matching, ok);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size_mb = 64;
+    size_t line_len = 80;
+    size_t match_every = 100;
+    int iterations = 5;
+    const char *pattern = "needle";
+    struct bench_result reference;
+    struct bench_result result;
+    size_t len, pattern_len, pos, line;
+    unsigned int seed = 1;
+    int impl;
+    int rc = 0;
+    int opt;
+    char *buf;
+
+    while ((opt = getopt(argc, argv, "s:l:m:n:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            size_mb = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            line_len = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            match_every = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'p':
+            pattern = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s size_mb] [-l line_len] [-m match_every] [-n iterations] [-p pattern]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    pattern_len = strlen(pattern);
+    if (size_mb < 1 || line_len < 2 || match_every < 1 || iterations < 1 || pattern_len < 1 ||
+        pattern_len >= line_len)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+    len = size_mb * 1024 * 1024;
+    buf = malloc(len);
+    if (buf == NULL)
+    {
+        fprintf(stderr, "Could not allocate %zu MB\n", size_mb);
+        return 1;
+    }
+    // Lowercase text lines of 1 to 2 * line_len bytes, the pattern in the middle of every
+    // match_every-th one
+    for (pos = 0, line = 0; pos < len; line++)
+    {
+        size_t this_len = 1 + rand_r(&seed) % (2 * line_len);
+        size_t i;
+
+        for (i = 0; i < this_len - 1 && pos < len; i++)
+        {
+            buf[pos++] = 'a' + rand_r(&seed) % 26;
+        }
+        if (line % match_every == 0 && this_len > pattern_len + 1 && pos >= this_len / 2 + pattern_len)
+        {
+            memcpy(buf + pos - this_len / 2 - pattern_len / 2, pattern, pattern_len);
+        }
+        if (pos < len)
+        {
+            buf[pos++] = '\n';
+        }
+    }
+
+    scan_select(SCAN_IMPL_SCALAR);
+    run(buf, len, pattern, iterations, false, &reference);
+    print_result(scan_impl_name(SCAN_IMPL_SCALAR), len, iterations, &reference, NULL);
+    for (impl = SCAN_IMPL_SCALAR + 1; impl < SCAN_IMPL_COUNT; impl++)
+    {
+        if (!scan_select(impl))
+        {
+            printf("impl=%s unsupported\n", scan_impl_name(impl));
+            continue;
+        }
+        run(buf, len, pattern, iterations, false, &result);
+        print_result(scan_impl_name(impl), len, iterations, &result, &reference);
+        rc |= result.lines != reference.lines || result.newlines != reference.newlines ||
+              result.matching != reference.matching;
+    }
+    run(buf, len, pattern, iterations, true, &result);
+    print_result("glibc", len, iterations, &result, &reference);
+    rc |= result.lines != reference.lines || result.newlines != reference.newlines ||
+          result.matching != reference.matching;
+    free(buf);
+    return rc;
+}
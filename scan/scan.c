@@ -0,0 +1,280 @@
+/**
+ * scan.c
+ *
+ *  @brief Scalar, SSE2 and AVX2 implementations of the scan functions and the dispatch
+ *  between them.
+ *
+ *  The scalar versions are built on memchr() and memmem(), which libc already vectorizes,
+ *  and are the only ones outside x86.  The vector versions compare a whole register against
+ *  the byte looked for and turn the result into a bit mask, so a 16 or 32 byte block without a
+ *  match costs a few instructions.  Substring search compares the first and the last byte of
+ *  the needle at every position of the block at once and only calls memcmp() where both match.
+ *  Vector loads never cross the end of the buffer, the bytes left over at the end go through
+ *  the scalar version.
+ */
+
+#define _GNU_SOURCE /* memmem() */
+#include "scan.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+struct scan_ops
+{
+    const char *(*newline)(const char *buf, size_t len);
+    size_t (*count_newlines)(const char *buf, size_t len);
+    const char *(*find)(const char *buf, size_t len, const char *needle, size_t needle_len);
+};
+
+static const char *newline_scalar(const char *buf, size_t len)
+{
+    return memchr(buf, '\n', len);
+}
+
+static size_t count_newlines_scalar(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    size_t count = 0;
+
+    while ((buf = memchr(buf, '\n', end - buf)) != NULL)
+    {
+        count++;
+        buf++;
+    }
+    return count;
+}
+
+static const char *find_scalar(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    return memmem(buf, len, needle, needle_len);
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static size_t count_newlines_sse2(const char *buf, size_t len)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i counters;
+    __m128i sums;
+    size_t count = 0;
+    size_t i = 0;
+    int blocks;
+
+    while (i + 16 <= len)
+    {
+        // A matching byte compares to 0xff, subtracting it bumps a per byte counter.  Flush the
+        // counters every 255 blocks, before they can wrap.
+        counters = _mm_setzero_si128();
+        for (blocks = 0; blocks < 255 && i + 16 <= len; blocks++, i += 16)
+        {
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), newline));
+        }
+        sums = _mm_sad_epu8(counters, zero);
+        count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+    }
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + needle_len - 1 + 16 <= len; i += 16)
+    {
+        __m128i starts = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), first);
+        __m128i ends = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + needle_len - 1)), last);
+        for (mask = _mm_movemask_epi8(_mm_and_si128(starts, ends)); mask; mask &= mask - 1)
+        {
+            const char *candidate = buf + i + __builtin_ctz(mask);
+            if (memcmp(candidate, needle, needle_len) == 0)
+            {
+                return candidate;
+            }
+        }
+    }
+    return find_scalar(buf + i, len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char *buf, size_t len)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i counters;
+    uint64_t sums[4];
+    size_t count = 0;
+    size_t i = 0;
+    int blocks;
+
+    while (i + 32 <= len)
+    {
+        counters = _mm256_setzero_si256();
+        for (blocks = 0; blocks < 255 && i + 32 <= len; blocks++, i += 32)
+        {
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), newline));
+        }
+        _mm256_storeu_si256((__m256i *)sums, _mm256_sad_epu8(counters, zero));
+        count += sums[0] + sums[1] + sums[2] + sums[3];
+    }
+    return count + count_newlines_sse2(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + needle_len - 1 + 32 <= len; i += 32)
+    {
+        __m256i starts = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), first);
+        __m256i ends = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + needle_len - 1)), last);
+        for (mask = _mm256_movemask_epi8(_mm256_and_si256(starts, ends)); mask; mask &= mask - 1)
+        {
+            const char *candidate = buf + i + __builtin_ctz(mask);
+            if (memcmp(candidate, needle, needle_len) == 0)
+            {
+                return candidate;
+            }
+        }
+    }
+    return find_sse2(buf + i, len - i, needle, needle_len);
+}
+
+#endif /* SCAN_X86 */
+
+static const struct scan_ops scan_ops_table[SCAN_IMPL_COUNT] = {
+    [SCAN_IMPL_SCALAR] = {newline_scalar, count_newlines_scalar, find_scalar},
+#ifdef SCAN_X86
+    // memchr() finds a newline as fast as the vector loops, only counting and substring search
+    // gain from them
+    [SCAN_IMPL_SSE2] = {newline_scalar, count_newlines_sse2, find_sse2},
+    [SCAN_IMPL_AVX2] = {newline_scalar, count_newlines_avx2, find_avx2},
+#endif
+};
+
+static enum scan_impl scan_impl = SCAN_IMPL_SCALAR;
+static const struct scan_ops *scan_ops = &scan_ops_table[SCAN_IMPL_SCALAR];
+
+static bool scan_supported(enum scan_impl impl)
+{
+    switch (impl)
+    {
+    case SCAN_IMPL_SCALAR:
+        return true;
+#ifdef SCAN_X86
+    case SCAN_IMPL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SCAN_IMPL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool scan_select(enum scan_impl impl)
+{
+    int i;
+
+    if (impl == SCAN_IMPL_BEST)
+    {
+        for (i = SCAN_IMPL_COUNT - 1; !scan_supported(i); i--)
+            ;
+        impl = i;
+    }
+    else if (impl > SCAN_IMPL_BEST || !scan_supported(impl))
+    {
+        return false;
+    }
+    scan_impl = impl;
+    scan_ops = &scan_ops_table[impl];
+    return true;
+}
+
+enum scan_impl scan_selected(void)
+{
+    return scan_impl;
+}
+
+const char *scan_impl_name(enum scan_impl impl)
+{
+    static const char *const names[SCAN_IMPL_COUNT] = {"scalar", "sse2", "avx2"};
+
+    return impl < SCAN_IMPL_COUNT ? names[impl] : "unknown";
+}
+
+/**
+ * Pick the implementation before main() runs, so the scan functions need no check on every
+ * call
+ */
+__attribute__((constructor))
+static void scan_init(void)
+{
+#ifdef SCAN_X86
+    // Constructors may run before the one of libgcc filling in the CPU features
+    __builtin_cpu_init();
+#endif
+    scan_select(SCAN_IMPL_BEST);
+}
+
+const char *scan_newline(const char *buf, size_t len)
+{
+    return scan_ops->newline(buf, len);
+}
+
+size_t scan_count_newlines(const char *buf, size_t len)
+{
+    return scan_ops->count_newlines(buf, len);
+}
+
+const char *scan_find(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+    {
+        return buf;
+    }
+    if (needle_len > len)
+    {
+        return NULL;
+    }
+    return scan_ops->find(buf, len, needle, needle_len);
+}
+
+size_t scan_count_matching_lines(const char *buf, size_t len, const char *needle, size_t needle_len)
+{
+    const char *end = buf + len;
+    const char *match;
+    const char *newline;
+    size_t lines = 0;
+
+    if (needle_len == 0)
+    {
+        // Every line, including an unterminated last one
+        return scan_count_newlines(buf, len) + (len > 0 && buf[len - 1] != '\n');
+    }
+    while ((match = scan_find(buf, end - buf, needle, needle_len)) != NULL)
+    {
+        lines++;
+        // The rest of the line can not add another match, continue after its newline
+        newline = scan_newline(match + needle_len - 1, end - (match + needle_len - 1));
+        if (newline == NULL)
+        {
+            break;
+        }
+        buf = newline + 1;
+    }
+    return lines;
+}
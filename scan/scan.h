@@ -0,0 +1,74 @@
+/*
+ * scan.h
+ *
+ *  @brief Newline and substring scanning shared by the user space tools: aesdsocket packet
+ *  framing and the finder line counting.
+ *
+ *  Every function has a scalar implementation on top of memchr() and memmem() and, on x86,
+ *  SSE2 and AVX2 ones for newline counting and substring search.  The fastest
+ *  implementation supported by the CPU is selected when the program starts, scan_select()
+ *  forces another one for benchmarks and tests.  The kernel module keeps using memchr().
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+enum scan_impl
+{
+    SCAN_IMPL_SCALAR,
+    SCAN_IMPL_SSE2,
+    SCAN_IMPL_AVX2,
+    SCAN_IMPL_COUNT,
+    /**
+     * For scan_select(): the fastest implementation the CPU supports
+     */
+    SCAN_IMPL_BEST = SCAN_IMPL_COUNT,
+};
+
+/**
+ * @return a pointer to the first '\n' of [@param buf, @param buf + @param len), NULL if there
+ * is none
+ */
+const char *scan_newline(const char *buf, size_t len);
+
+/**
+ * @return the number of '\n' in [@param buf, @param buf + @param len)
+ */
+size_t scan_count_newlines(const char *buf, size_t len);
+
+/**
+ * @return a pointer to the first occurrence of @param needle of @param needle_len bytes in
+ * [@param buf, @param buf + @param len), NULL if there is none.  An empty needle matches at
+ * @param buf.
+ */
+const char *scan_find(const char *buf, size_t len, const char *needle, size_t needle_len);
+
+/**
+ * @return the number of lines of [@param buf, @param buf + @param len) containing
+ * @param needle, counting an unterminated last line like grep does.  An empty needle
+ * matches every line.
+ */
+size_t scan_count_matching_lines(const char *buf, size_t len, const char *needle, size_t needle_len);
+
+/**
+ * Use @param impl for all the scan functions from now on.  Not thread safe, call it before
+ * starting threads which scan.
+ * @return false, leaving the current implementation in place, if the CPU or the build does
+ * not support @param impl
+ */
+bool scan_select(enum scan_impl impl);
+
+/**
+ * @return the implementation in use
+ */
+enum scan_impl scan_selected(void);
+
+/**
+ * @return the name of @param impl, "scalar", "sse2" or "avx2"
+ */
+const char *scan_impl_name(enum scan_impl impl);
+
+#endif /* SCAN_H */
@@ -17,11 +17,17 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "../scan/scan.h"
 
 #define MYPORT "9000"
 #define BACKLOG 10
 #define BUFSIZE 5 * 1024 * 1024
+#define RECV_CHUNK 4096
 #if defined USE_AESD_CHAR_DEVICE && USE_AESD_CHAR_DEVICE == 1
 #define DUMPFILE "/dev/aesdchar"
 #else
@@ -30,15 +36,62 @@
 
 #define ALRM_INT_SEC 10
 
+/*
+ * Pipelined connections start with a handshake line instead of a packet, the server answers
+ * PIPELINE_ACK and then every packet gets a reply made of a REPLY_HEADER line and the number of
+ * bytes it gives, either the whole DUMPFILE (FULL) or what was appended to it since the
+ * previous reply on the connection (NEW).  Other connections get one reply without header and
+ * are closed, as before.
+ *
+ * Such a one reply connection may start with a MODE_DELTA line to get only what was appended
+ * since the previous reply to the same client, or MODE_FULL for the whole file when -r delta
+ * made delta replies the default.  Clients are told apart by their address, or by the id given
+ * as "AESDSOCKET_MODE:DELTA:<id>".
+ */
+#define PIPELINE_FULL "AESDSOCKET_PIPELINE:FULL\n"
+#define PIPELINE_NEW "AESDSOCKET_PIPELINE:NEW\n"
+#define PIPELINE_ACK "AESDSOCKET_PIPELINE:OK\n"
+#define REPLY_HEADER "AESDSOCKET_REPLY:%zu\n"
+#define MODE_FULL "AESDSOCKET_MODE:FULL\n"
+#define MODE_DELTA "AESDSOCKET_MODE:DELTA"
+#define MAX_CLIENT_CURSORS 256
+
+enum reply_mode
+{
+    REPLY_FULL,
+    REPLY_NEW,
+};
+
+/**
+ * End of the last delta reply sent to a client, kept across its connections.  Positions are
+ * those of read_new_content().
+ */
+struct client_cursor
+{
+    char client[INET6_ADDRSTRLEN];
+    uint64_t cursor;
+    time_t last_seen;
+    SLIST_ENTRY(client_cursor)
+    entries;
+};
+
+/**
+ * Guarded by mutex, like DUMPFILE
+ */
+SLIST_HEAD(client_cursor_head, client_cursor) client_cursors = SLIST_HEAD_INITIALIZER(client_cursors);
+int client_cursor_count = 0;
+
+enum reply_mode default_reply_mode = REPLY_FULL;
+
 bool term_int_caught = false;
 pthread_mutex_t mutex;
 
-int write_to_file(const int fd, const char *str)
+int write_to_file(const int fd, const char *str, size_t len)
 {
 
-    if(strncmp(str, "AESDCHAR_IOCSEEKTO:", strlen("AESDCHAR_IOCSEEKTO:")) == 0)
+    if(len >= strlen("AESDCHAR_IOCSEEKTO:") && strncmp(str, "AESDCHAR_IOCSEEKTO:", strlen("AESDCHAR_IOCSEEKTO:")) == 0)
     {
-        //IOCTL command
+        //IOCTL command, sscanf stops at the newline ending the packet
         struct aesd_seekto seekto;
         sscanf(str, "AESDCHAR_IOCSEEKTO:%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset);
         ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto);
@@ -46,29 +99,64 @@ int write_to_file(const int fd, const char *str)
     else
     {
         // write to buffer
-        ssize_t written_bytes = write(fd, str, strlen(str));
-        if(written_bytes != strlen(str)){
+        ssize_t written_bytes = write(fd, str, len);
+        if(written_bytes < 0 || (size_t)written_bytes != len){
             syslog(LOG_ERR, "Write Failed");
             return 1;
         }
+#if !defined USE_AESD_CHAR_DEVICE || USE_AESD_CHAR_DEVICE != 1
+        // The reply is read from the start of the file, the append left the offset at its end
+        lseek(fd, 0, SEEK_SET);
+#endif
     }
     return 0;
 }
 
-char *read_file_content(const int fd)
+/**
+ * Read DUMPFILE opened as @param fd from its current position to its end, the start of the file
+ * unless an AESDCHAR_IOCSEEKTO command moved it
+ * @return a malloc'ed buffer of *@param len bytes followed by a '\0', NULL on error
+ */
+char *read_file_content(const int fd, size_t *len)
 {
-    char *buffer = malloc(BUFSIZE);
-    if (buffer)
+    size_t capacity = RECV_CHUNK;
+    char *buffer = malloc(capacity);
+    char *bigger;
+    ssize_t rc;
+
+    *len = 0;
+    while (buffer != NULL)
     {
-        int count = 0;
-        char tmp;
-        while(read(fd, &tmp, 1)){
-            buffer[count] = tmp;
-            count++;
+        if (*len == capacity - 1)
+        {
+            capacity *= 2;
+            bigger = realloc(buffer, capacity);
+            if (bigger == NULL)
+            {
+                free(buffer);
+            }
+            buffer = bigger;
+            continue;
+        }
+        rc = read(fd, buffer + *len, capacity - 1 - *len);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+        {
+            syslog(LOG_ERR, "Read Failed");
+            free(buffer);
+            return NULL;
         }
-        buffer[count] = '\0';
+        if (rc == 0)
+            break;
+        *len += rc;
     }
-
+    if (buffer == NULL)
+    {
+        syslog(LOG_ERR, "Out of memory reading %s", DUMPFILE);
+        return NULL;
+    }
+    buffer[*len] = '\0';
     return buffer;
 }
 
@@ -100,55 +188,459 @@ struct recv_send_socket_data
     bool thread_complete;
     bool success;
     int sockfd_accepted;
+    char client[INET6_ADDRSTRLEN];
     pthread_mutex_t *mutex;
-    pthread_t *thread;
+    pthread_t thread;
     SLIST_ENTRY(recv_send_socket_data)
     entries; /* Singly linked list */
 };
 
+/**
+ * Bytes received on a connection, the packet being framed at the front
+ */
+struct recv_buffer
+{
+    char *data;
+    size_t len;      /* bytes received and not consumed yet */
+    size_t scanned;  /* leading bytes already searched for a newline */
+    size_t capacity;
+};
+
+/**
+ * Receive on @param sockfd until @param rb holds a newline terminated packet, the peer closes
+ * the connection or BUFSIZE bytes are buffered without a newline.  A packet may span several
+ * recv() calls, bytes received after its newline stay buffered for the next call.
+ * @return the length of the packet at the front of @param rb, newline included, 0 if the
+ * connection was closed with nothing buffered, -1 on error
+ */
+ssize_t recv_packet(int sockfd, struct recv_buffer *rb)
+{
+    const char *newline;
+    ssize_t received;
+
+    for (;;)
+    {
+        if (rb->len > rb->scanned)
+        {
+            // Only the bytes of the last recv() need looking at
+            newline = scan_newline(rb->data + rb->scanned, rb->len - rb->scanned);
+            if (newline != NULL)
+            {
+                return newline - rb->data + 1;
+            }
+            rb->scanned = rb->len;
+        }
+        if (rb->len == BUFSIZE)
+        {
+            // Hand an overlong packet over as is, like a single full recv() did
+            return rb->len;
+        }
+        if (rb->len == rb->capacity)
+        {
+            size_t capacity = rb->capacity ? rb->capacity * 2 : RECV_CHUNK;
+            char *data = realloc(rb->data, capacity < BUFSIZE ? capacity : BUFSIZE);
+            if (data == NULL)
+            {
+                return -1;
+            }
+            rb->data = data;
+            rb->capacity = capacity < BUFSIZE ? capacity : BUFSIZE;
+        }
+        received = recv(sockfd, rb->data + rb->len, rb->capacity - rb->len, 0);
+        if (received == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (received == 0)
+        {
+            // Closed, whatever is left is the last packet
+            return rb->len;
+        }
+        rb->len += received;
+    }
+}
+
+/**
+ * Drop the first @param len bytes, a packet returned by recv_packet(), from @param rb
+ */
+void recv_buffer_consume(struct recv_buffer *rb, size_t len)
+{
+    memmove(rb->data, rb->data + len, rb->len - len);
+    rb->len -= len;
+    rb->scanned = rb->scanned > len ? rb->scanned - len : 0;
+}
+
+/**
+ * Send all @param len bytes of @param buf with send() @param flags, without raising SIGPIPE if
+ * the peer is gone
+ * @return 0 on success
+ */
+int send_all(int sockfd, const char *buf, size_t len, int flags)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        sent = send(sockfd, buf, len, flags | MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/**
+ * @return the position after the last byte of DUMPFILE opened as @param fd: a stream
+ * position of the char device, which evictions do not move, or the size of the file
+ */
+uint64_t content_end(int fd)
+{
+#if defined USE_AESD_CHAR_DEVICE && USE_AESD_CHAR_DEVICE == 1
+    // Without room for the data the snapshot fails with ENOSPC, still reporting its end
+    struct aesd_snapshot snap = {0};
+    ioctl(fd, AESDCHAR_IOCSNAPSHOT, &snap);
+    return snap.generation;
+#else
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_size : 0;
+#endif
+}
+
+/**
+ * Read the bytes of DUMPFILE opened as @param fd after position *@param cursor and move the
+ * cursor after them.  On the char device, bytes evicted before they could be read are skipped.
+ * @return a malloc'ed buffer of *@param len bytes followed by a '\0', NULL on error
+ */
+char *read_new_content(int fd, uint64_t *cursor, size_t *len)
+{
+    size_t capacity = RECV_CHUNK;
+    char *buffer = malloc(capacity);
+    char *bigger;
+#if defined USE_AESD_CHAR_DEVICE && USE_AESD_CHAR_DEVICE == 1
+    struct aesd_snapshot snap = {.since = *cursor};
+
+    for (;;)
+    {
+        if (buffer == NULL)
+        {
+            return NULL;
+        }
+        snap.buf = (uintptr_t)buffer;
+        snap.len = capacity - 1;
+        if (ioctl(fd, AESDCHAR_IOCSNAPSHOT, &snap) == 0)
+        {
+            break;
+        }
+        if (errno != ENOSPC)
+        {
+            syslog(LOG_ERR, "snapshot since %" PRIu64 " failed", *cursor);
+            free(buffer);
+            return NULL;
+        }
+        // snap.len is now the size needed, it may still grow before the next call
+        capacity = snap.len + 1;
+        bigger = realloc(buffer, capacity);
+        if (bigger == NULL)
+        {
+            free(buffer);
+        }
+        buffer = bigger;
+    }
+    if (snap.flags & AESD_SNAPSHOT_TRUNCATED)
+    {
+        syslog(LOG_INFO, "%" PRIu64 " bytes evicted before they were sent", snap.start - *cursor);
+    }
+    *cursor = snap.generation;
+    *len = snap.len;
+#else
+    ssize_t rc;
+
+    *len = 0;
+    while (buffer != NULL)
+    {
+        if (*len == capacity - 1)
+        {
+            capacity *= 2;
+            bigger = realloc(buffer, capacity);
+            if (bigger == NULL)
+            {
+                free(buffer);
+            }
+            buffer = bigger;
+            continue;
+        }
+        rc = pread(fd, buffer + *len, capacity - 1 - *len, *cursor + *len);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+        {
+            free(buffer);
+            return NULL;
+        }
+        if (rc == 0)
+            break;
+        *len += rc;
+    }
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+    *cursor += *len;
+#endif
+    buffer[*len] = '\0';
+    return buffer;
+}
+
+/**
+ * Find the cursor of @param client, creating it at the start of DUMPFILE for a client never
+ * seen, which then gets the whole file first.  The least recently seen client is forgotten
+ * when MAX_CLIENT_CURSORS are tracked.  Must be called with mutex held.
+ * @return the cursor, NULL if out of memory
+ */
+struct client_cursor *client_cursor_get(const char *client)
+{
+    struct client_cursor *cc;
+    struct client_cursor *oldest = NULL;
+
+    SLIST_FOREACH(cc, &client_cursors, entries)
+    {
+        if (strcmp(cc->client, client) == 0)
+        {
+            cc->last_seen = time(NULL);
+            return cc;
+        }
+        if (oldest == NULL || cc->last_seen < oldest->last_seen)
+        {
+            oldest = cc;
+        }
+    }
+    if (client_cursor_count == MAX_CLIENT_CURSORS)
+    {
+        syslog(LOG_INFO, "Forgetting the delta cursor of %s", oldest->client);
+        SLIST_REMOVE(&client_cursors, oldest, client_cursor, entries);
+        client_cursor_count--;
+        cc = oldest;
+    }
+    else
+    {
+        cc = malloc(sizeof(struct client_cursor));
+        if (cc == NULL)
+        {
+            return NULL;
+        }
+    }
+    snprintf(cc->client, sizeof(cc->client), "%s", client);
+    cc->cursor = 0;
+    cc->last_seen = time(NULL);
+    SLIST_INSERT_HEAD(&client_cursors, cc, entries);
+    client_cursor_count++;
+    return cc;
+}
+
+/**
+ * Parse a MODE_FULL or MODE_DELTA line of @param len bytes at @param packet, a MODE_DELTA id
+ * replaces the address in @param client
+ * @return true if @param packet is such a line
+ */
+bool parse_mode(const char *packet, size_t len, enum reply_mode *mode, char *client)
+{
+    size_t prefix = strlen(MODE_DELTA);
+
+    if (len == strlen(MODE_FULL) && strncmp(packet, MODE_FULL, len) == 0)
+    {
+        *mode = REPLY_FULL;
+        return true;
+    }
+    if (len < prefix + 1 || strncmp(packet, MODE_DELTA, prefix) != 0 ||
+        (packet[prefix] != '\n' && packet[prefix] != ':'))
+    {
+        return false;
+    }
+    *mode = REPLY_NEW;
+    // The id, without the ':' and the newline, truncated to the size of an address
+    size_t id_len = len - prefix - 1 - (packet[len - 1] == '\n');
+    if (packet[prefix] == ':' && id_len > 0)
+    {
+        if (id_len >= INET6_ADDRSTRLEN)
+            id_len = INET6_ADDRSTRLEN - 1;
+        memcpy(client, packet + prefix + 1, id_len);
+        client[id_len] = '\0';
+    }
+    return true;
+}
+
+/**
+ * Serve a pipelined connection after its handshake: write every packet received to DUMPFILE
+ * and send its reply, until the peer closes the connection
+ * @return 0 if the connection ended without error
+ */
+int serve_pipeline(struct recv_send_socket_data *thread_func_args, struct recv_buffer *rb, enum reply_mode mode)
+{
+    int sockfd = thread_func_args->sockfd_accepted;
+    char header[64];
+    uint64_t cursor = 0;
+    ssize_t packet_len;
+    size_t len = 0;
+    char *reply;
+    int fd;
+
+    if (mode == REPLY_NEW)
+    {
+        // Only what is written from now on is new to this connection
+        pthread_mutex_lock(thread_func_args->mutex);
+        fd = open(DUMPFILE, O_RDWR|O_CREAT|O_APPEND, 0777);
+        cursor = 0;
+        if (fd != -1)
+        {
+            cursor = content_end(fd);
+            close(fd);
+        }
+        pthread_mutex_unlock(thread_func_args->mutex);
+    }
+    // Replies are small and each one is waited for, do not let Nagle hold them back
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    if (send_all(sockfd, PIPELINE_ACK, strlen(PIPELINE_ACK), 0) != 0)
+    {
+        return 1;
+    }
+
+    while ((packet_len = recv_packet(sockfd, rb)) > 0)
+    {
+        reply = NULL;
+        pthread_mutex_lock(thread_func_args->mutex);
+        fd = open(DUMPFILE, O_RDWR|O_CREAT|O_APPEND, 0777);
+        if (fd != -1 && !write_to_file(fd, rb->data, packet_len))
+        {
+            if (mode == REPLY_FULL)
+            {
+                reply = read_file_content(fd, &len);
+            }
+            else
+            {
+                reply = read_new_content(fd, &cursor, &len);
+            }
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        pthread_mutex_unlock(thread_func_args->mutex);
+        recv_buffer_consume(rb, packet_len);
+
+        // Other connections can write while this reply is on its way
+        if (reply == NULL)
+        {
+            syslog(LOG_ERR, "\n thread failed! .. write to file fail\n");
+            return 1;
+        }
+        snprintf(header, sizeof(header), REPLY_HEADER, len);
+        // MSG_MORE sends the header in the same segment as the start of the reply
+        if (send_all(sockfd, header, strlen(header), MSG_MORE) != 0 || send_all(sockfd, reply, len, 0) != 0)
+        {
+            syslog(LOG_ERR, "\n thread failed! .. send error\n");
+            free(reply);
+            return 1;
+        }
+        free(reply);
+    }
+    return packet_len == -1;
+}
+
 void *recv_send_socket_thread(void *thread_param)
 {
     syslog(LOG_INFO, "Started Thread!");
 
     struct recv_send_socket_data *thread_func_args = (struct recv_send_socket_data *)thread_param;
-    // obtain
-    if (pthread_mutex_lock(thread_func_args->mutex) != 0)
+    struct recv_buffer rb = {0};
+    ssize_t packet_len = recv_packet(thread_func_args->sockfd_accepted, &rb);
+    const char *newline;
+    if (packet_len == strlen(PIPELINE_FULL) && strncmp(rb.data, PIPELINE_FULL, packet_len) == 0)
+    {
+        recv_buffer_consume(&rb, packet_len);
+        thread_func_args->success = serve_pipeline(thread_func_args, &rb, REPLY_FULL) == 0;
+        packet_len = 0;
+    }
+    else if (packet_len == strlen(PIPELINE_NEW) && strncmp(rb.data, PIPELINE_NEW, packet_len) == 0)
+    {
+        recv_buffer_consume(&rb, packet_len);
+        thread_func_args->success = serve_pipeline(thread_func_args, &rb, REPLY_NEW) == 0;
+        packet_len = 0;
+    }
+    enum reply_mode mode = default_reply_mode;
+    char client[INET6_ADDRSTRLEN];
+    memcpy(client, thread_func_args->client, sizeof(client));
+    if (packet_len > 0 && parse_mode(rb.data, packet_len, &mode, client))
+    {
+        recv_buffer_consume(&rb, packet_len);
+        packet_len = recv_packet(thread_func_args->sockfd_accepted, &rb);
+    }
+    // Complete packets which came along with the first one are written with it, as when the
+    // whole recv() was written
+    while (packet_len > 0 && (newline = scan_newline(rb.data + packet_len, rb.len - packet_len)) != NULL)
+    {
+        packet_len = newline - rb.data + 1;
+    }
+    if (packet_len == -1)
+    {
+        syslog(LOG_ERR, "\n thread failed! .. recv error\n");
+    }
+    else if (packet_len == 0)
+    {
+        syslog(LOG_INFO, "Connection closed");
+    }
+    // obtain, the packet is complete so other connections do not wait on this client
+    else if (pthread_mutex_lock(thread_func_args->mutex) != 0)
     {
         syslog(LOG_ERR, "\n thread failed! .. mutex obtaining failed\n");
     }
     else
     {
-        char msg[BUFSIZE];
-        memset(&msg, 0, BUFSIZE);
-        int recevied_bytes = recv(thread_func_args->sockfd_accepted, msg, BUFSIZE, 0);
-        if (recevied_bytes == -1)
+        int fd = open(DUMPFILE, O_RDWR|O_CREAT|O_APPEND, 0777);
+        if (fd == -1)
         {
-            syslog(LOG_ERR, "\n thread failed! .. recv error\n");
+            syslog(LOG_ERR, "\n thread failed! .. cannot open %s\n", DUMPFILE);
         }
-        else
+        else if (!write_to_file(fd, rb.data, packet_len))
         {
-            int fd = open(DUMPFILE, O_RDWR|O_CREAT|O_APPEND, 0777);
-            if (!write_to_file(fd, msg))
+            char *buffer = NULL;
+            size_t len = 0;
+            struct client_cursor *cc = mode == REPLY_NEW ? client_cursor_get(client) : NULL;
+            if (cc)
             {
-                char *buffer = read_file_content(fd);
-                syslog(LOG_DEBUG, "File_Content: %s", buffer);
-                if (buffer)
-                {
-                    if (send(thread_func_args->sockfd_accepted, buffer, strlen(buffer), 0) == -1)
-                    {
-                        syslog(LOG_ERR, "\n thread failed! .. send error\n");
-                    }
-                    else
-                    {
-                        thread_func_args->success = true;
-                    }
-                }
-                free(buffer);
+                buffer = read_new_content(fd, &cc->cursor, &len);
             }
             else
             {
-                syslog(LOG_ERR, "\n thread failed! .. write to file fail\n");
+                buffer = read_file_content(fd, &len);
             }
+            if (buffer)
+            {
+                syslog(LOG_DEBUG, "File_Content: %s", buffer);
+                if (send(thread_func_args->sockfd_accepted, buffer, len, 0) == -1)
+                {
+                    syslog(LOG_ERR, "\n thread failed! .. send error\n");
+                }
+                else
+                {
+                    thread_func_args->success = true;
+                }
+            }
+            free(buffer);
+        }
+        else
+        {
+            syslog(LOG_ERR, "\n thread failed! .. write to file fail\n");
+        }
+        if (fd != -1)
+        {
             close(fd);
         }
 
@@ -157,12 +649,10 @@ void *recv_send_socket_thread(void *thread_param)
         {
             syslog(LOG_ERR, "\n thread failed! .. mutex releasing failed\n");
         }
-        else
-        {
-            thread_func_args->thread_complete = true;
-        }
     }
+    free(rb.data);
     close(thread_func_args->sockfd_accepted);
+    thread_func_args->thread_complete = true;
     return thread_param;
 }
 
@@ -210,7 +700,7 @@ void write_time_to_file(const char *filename)
     strcat(result, "\n");
 
     int fd = open(filename, O_RDWR|O_CREAT|O_APPEND, 0777);
-    write_to_file(fd, result);
+    write_to_file(fd, result, strlen(result));
     free(t);
     free(result);
 }
@@ -308,13 +798,25 @@ int main(int argc, char *argv[])
 
     bool isdaemon = false;
     int opt;
-    while ((opt = getopt(argc, argv, "d")) != -1)
+    while ((opt = getopt(argc, argv, "dr:")) != -1)
     {
         switch (opt)
         {
         case 'd':
             isdaemon = true;
             break;
+        case 'r':
+            // Reply mode of connections which do not choose one
+            if (strcmp(optarg, "delta") == 0)
+                default_reply_mode = REPLY_NEW;
+            else if (strcmp(optarg, "full") == 0)
+                default_reply_mode = REPLY_FULL;
+            else
+            {
+                syslog(LOG_ERR, "Unknown reply mode %s, expected full or delta", optarg);
+                return 1;
+            }
+            break;
         default: /* do nothing */;
         }
     }
@@ -394,7 +896,7 @@ int main(int argc, char *argv[])
     {
         struct sockaddr_storage their_addr;
         memset(&their_addr, 0, sizeof(struct sockaddr_storage));
-        socklen_t addr_size = 0;
+        socklen_t addr_size = sizeof(their_addr);
         int sockfd_accepted = accept(sockfd, (struct sockaddr *)&their_addr, &addr_size);
         if (sockfd_accepted == -1)
         {
@@ -411,14 +913,13 @@ int main(int argc, char *argv[])
                   s, sizeof s);
         syslog(LOG_INFO, "Accepted connection from %s", s);
 
-        pthread_t thread;
         struct recv_send_socket_data *thread_func_args = malloc(sizeof(struct recv_send_socket_data));
         thread_func_args->thread_complete = false;
         thread_func_args->success = false;
         thread_func_args->sockfd_accepted = sockfd_accepted;
+        memcpy(thread_func_args->client, s, sizeof(thread_func_args->client));
         thread_func_args->mutex = &mutex;
-        thread_func_args->thread = &thread;
-        int err = pthread_create(&thread, NULL, &recv_send_socket_thread, thread_func_args);
+        int err = pthread_create(&thread_func_args->thread, NULL, &recv_send_socket_thread, thread_func_args);
         if (err != 0)
         {
             syslog(LOG_ERR, "\ncan't create thread");
@@ -427,17 +928,20 @@ int main(int argc, char *argv[])
         }
         else
         {
-            // This is not a good implementation since we start searching from previous Head everytime and we are inserting new thread as Head
-            // Incase the previous thread is not finished then we inserted a new head then most probably the next interation would also find the new head not finished yet
-            // But it works anyway our program is not that complicated and threads are executed fast enough
-            struct recv_send_socket_data *n1;
-            n1 = SLIST_FIRST(&head);
-            while (n1 && n1->thread_complete)
+            // Reap every finished thread, a long lived pipelined client anywhere in the list
+            // must not keep the ones behind it around
+            struct recv_send_socket_data *n1 = SLIST_FIRST(&head);
+            struct recv_send_socket_data *next;
+            while (n1)
             {
-                pthread_join(*(n1->thread), NULL);
-                SLIST_REMOVE_HEAD(&head, entries);
-                free(n1);
-                n1 = SLIST_FIRST(&head);
+                next = SLIST_NEXT(n1, entries);
+                if (n1->thread_complete)
+                {
+                    pthread_join(n1->thread, NULL);
+                    SLIST_REMOVE(&head, n1, recv_send_socket_data, entries);
+                    free(n1);
+                }
+                n1 = next;
             }
             SLIST_INSERT_HEAD(&head, thread_func_args, entries);
         }
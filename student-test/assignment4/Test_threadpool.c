@@ -0,0 +1,97 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../examples/threading/threading.h"
+#include "../../examples/threading/threadpool.h"
+
+static void init_thread_data(struct thread_data *data, pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    data->thread_complete_success = false;
+    data->wait_to_obtain_ms = wait_to_obtain_ms;
+    data->wait_to_release_ms = wait_to_release_ms;
+    data->mutex = mutex;
+}
+
+/**
+ * Run threadfunc() through the pool for several thread_data sharing one mutex and check every
+ * task returns its own thread_data with thread_complete_success set, like a joined thread does
+ */
+void test_threadpool_runs_threadfunc()
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct thread_pool *pool = thread_pool_create(2, 8);
+    struct thread_data data[8];
+    struct thread_task *tasks[8];
+    int i;
+
+    TEST_ASSERT_NOT_NULL(pool);
+    for (i = 0; i < 8; i++)
+    {
+        init_thread_data(&data[i], &mutex, 1, 1);
+        tasks[i] = thread_pool_submit(pool, threadfunc, &data[i]);
+        TEST_ASSERT_NOT_NULL_MESSAGE(tasks[i], "Submitting up to max_tasks tasks should succeed");
+    }
+    for (i = 0; i < 8; i++)
+    {
+        TEST_ASSERT_EQUAL_PTR(&data[i], thread_task_wait(pool, tasks[i]));
+        TEST_ASSERT_TRUE_MESSAGE(data[i].thread_complete_success, "threadfunc should complete with success");
+    }
+    thread_pool_destroy(pool);
+}
+
+/**
+ * A task waiting for a mutex held by the test must not complete until the mutex is released
+ */
+void test_threadpool_task_blocks_on_held_mutex()
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct thread_pool *pool = thread_pool_create(1, 1);
+    struct thread_data data;
+    struct thread_task *task;
+
+    TEST_ASSERT_NOT_NULL(pool);
+    init_thread_data(&data, &mutex, 0, 0);
+    pthread_mutex_lock(&mutex);
+    task = thread_pool_submit(pool, threadfunc, &data);
+    TEST_ASSERT_NOT_NULL(task);
+    usleep(50 * 1000);
+    TEST_ASSERT_FALSE_MESSAGE(thread_task_done(task), "The task should still wait for the mutex");
+    pthread_mutex_unlock(&mutex);
+    TEST_ASSERT_EQUAL_PTR(&data, thread_task_wait(pool, task));
+    TEST_ASSERT_TRUE(data.thread_complete_success);
+    thread_pool_destroy(pool);
+}
+
+/**
+ * Task descriptors come from a fixed freelist, waiting for a task returns its descriptor
+ */
+void test_threadpool_descriptors_are_recycled()
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct thread_pool *pool = thread_pool_create(1, 2);
+    struct thread_data data[3];
+    struct thread_task *first;
+    struct thread_task *second;
+    struct thread_task *third;
+
+    TEST_ASSERT_NOT_NULL(pool);
+    init_thread_data(&data[0], &mutex, 0, 0);
+    init_thread_data(&data[1], &mutex, 0, 0);
+    init_thread_data(&data[2], &mutex, 0, 0);
+    first = thread_pool_submit(pool, threadfunc, &data[0]);
+    second = thread_pool_submit(pool, threadfunc, &data[1]);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_NULL_MESSAGE(thread_pool_submit(pool, threadfunc, &data[2]),
+                             "No descriptor should be left before a task is waited for");
+
+    TEST_ASSERT_EQUAL_PTR(&data[0], thread_task_wait(pool, first));
+    third = thread_pool_submit(pool, threadfunc, &data[2]);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(first, third, "The descriptor of the waited task should be reused");
+    TEST_ASSERT_EQUAL_PTR(&data[1], thread_task_wait(pool, second));
+    TEST_ASSERT_EQUAL_PTR(&data[2], thread_task_wait(pool, third));
+    TEST_ASSERT_TRUE(data[2].thread_complete_success);
+    thread_pool_destroy(pool);
+}
@@ -0,0 +1,146 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../scan/scan.h"
+
+/**
+ * Fill @param buf with @param len bytes of "ab" repeated, newlines at the positions where
+ * @param newline_every divides the index + 1
+ */
+static void fill(char *buf, size_t len, size_t newline_every)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = (i + 1) % newline_every == 0 ? '\n' : "ab"[i % 2];
+    }
+}
+
+/**
+ * Every implementation the CPU supports must find the same first newline and count the same
+ * newlines as the scalar one, for every length around the 16 and 32 byte vector blocks and
+ * every alignment of the start
+ */
+void test_scan_newline_implementations_agree()
+{
+    char *buf = malloc(300);
+    enum scan_impl previous = scan_selected();
+    size_t offset, len, every;
+    int impl;
+
+    TEST_ASSERT_NOT_NULL(buf);
+    for (every = 1; every <= 70; every += 23)
+    {
+        fill(buf, 300, every);
+        for (offset = 0; offset < 32; offset += 7)
+        {
+            for (len = 0; len + offset <= 300; len++)
+            {
+                const char *expected_newline;
+                size_t expected_count;
+
+                TEST_ASSERT_TRUE(scan_select(SCAN_IMPL_SCALAR));
+                expected_newline = scan_newline(buf + offset, len);
+                expected_count = scan_count_newlines(buf + offset, len);
+                for (impl = SCAN_IMPL_SCALAR + 1; impl < SCAN_IMPL_COUNT; impl++)
+                {
+                    if (!scan_select(impl))
+                    {
+                        continue;
+                    }
+                    TEST_ASSERT_EQUAL_PTR_MESSAGE(expected_newline, scan_newline(buf + offset, len),
+                                                  scan_impl_name(impl));
+                    TEST_ASSERT_EQUAL_MESSAGE(expected_count, scan_count_newlines(buf + offset, len),
+                                              scan_impl_name(impl));
+                }
+            }
+        }
+    }
+    TEST_ASSERT_TRUE(scan_select(previous));
+    free(buf);
+}
+
+/**
+ * The vector counters are flushed every 255 blocks, 4080 bytes for SSE2 and 8160 for AVX2.  A
+ * buffer made only of newlines fills every per byte counter to 255 before each flush, counts
+ * must stay exact across several flushes and from an unaligned start.
+ */
+void test_scan_count_newlines_across_counter_flushes()
+{
+    const size_t size = 40 * 1024;
+    char *buf = malloc(size);
+    enum scan_impl previous = scan_selected();
+    size_t offset;
+    int impl;
+
+    TEST_ASSERT_NOT_NULL(buf);
+    memset(buf, '\n', size);
+    for (impl = SCAN_IMPL_SCALAR; impl < SCAN_IMPL_COUNT; impl++)
+    {
+        if (!scan_select(impl))
+        {
+            continue;
+        }
+        for (offset = 1; offset < 64; offset += 13)
+        {
+            TEST_ASSERT_EQUAL_MESSAGE(size - offset, scan_count_newlines(buf + offset, size - offset),
+                                      scan_impl_name(impl));
+            TEST_ASSERT_EQUAL_MESSAGE(16 * 1024 + 5, scan_count_newlines(buf + offset, 16 * 1024 + 5),
+                                      scan_impl_name(impl));
+        }
+    }
+    TEST_ASSERT_TRUE(scan_select(previous));
+    free(buf);
+}
+
+/**
+ * A needle at the very end of the buffer, straddling a vector block or longer than a block
+ * must be found by every implementation, one cut off by the end of the buffer must not
+ */
+void test_scan_find_at_block_edges()
+{
+    const char *needle = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char buf[128];
+    enum scan_impl previous = scan_selected();
+    size_t needle_len, pos;
+    int impl;
+
+    for (impl = SCAN_IMPL_SCALAR; impl < SCAN_IMPL_COUNT; impl++)
+    {
+        if (!scan_select(impl))
+        {
+            continue;
+        }
+        for (needle_len = 1; needle_len <= strlen(needle); needle_len += 5)
+        {
+            for (pos = 0; pos + needle_len <= sizeof(buf); pos++)
+            {
+                memset(buf, '.', sizeof(buf));
+                memcpy(buf + pos, needle, needle_len);
+                TEST_ASSERT_EQUAL_PTR_MESSAGE(buf + pos, scan_find(buf, sizeof(buf), needle, needle_len),
+                                              scan_impl_name(impl));
+                TEST_ASSERT_EQUAL_PTR_MESSAGE(NULL, scan_find(buf, pos + needle_len - 1, needle, needle_len),
+                                              scan_impl_name(impl));
+            }
+        }
+    }
+    TEST_ASSERT_TRUE(scan_select(previous));
+}
+
+/**
+ * Matching lines are counted once however many times they hold the needle, like grep -c does
+ */
+void test_scan_count_matching_lines()
+{
+    const char *text = "foo foo\nbar\nfoofoo\n\nxfoo";
+
+    TEST_ASSERT_EQUAL(3, scan_count_matching_lines(text, strlen(text), "foo", 3));
+    TEST_ASSERT_EQUAL(1, scan_count_matching_lines(text, strlen(text), "bar\n", 4));
+    TEST_ASSERT_EQUAL(0, scan_count_matching_lines(text, strlen(text), "baz", 3));
+    TEST_ASSERT_EQUAL_MESSAGE(5, scan_count_matching_lines(text, strlen(text), "", 0),
+                              "An empty needle should match every line, the unterminated last one included");
+    TEST_ASSERT_EQUAL(0, scan_count_matching_lines(text, 0, "", 0));
+}
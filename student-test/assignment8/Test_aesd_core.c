@@ -0,0 +1,185 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-core.h"
+
+/**
+ * Feed @param str to @param core the way aesd_write_iter does, committing every completed command
+ * @return the number of commands committed
+ */
+static int core_write(struct aesd_core *core, const char *str)
+{
+    size_t len = strlen(str);
+    char *write_buf = malloc(len);
+    const char *start = write_buf;
+    const char *end = write_buf + len;
+    struct aesd_buffer_entry command;
+    struct aesd_buffer_entry evicted;
+    int commands = 0;
+    int rc;
+
+    memcpy(write_buf, str, len);
+    while ((rc = aesd_core_next_command(core, &start, end, &write_buf, &command)) > 0)
+    {
+        while (aesd_core_evict(core, command.size, &evicted))
+        {
+            free((void *)evicted.buffptr);
+        }
+        aesd_core_commit(core, &command);
+        commands++;
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, rc, "aesd_core_next_command failed");
+    free(write_buf);
+    return commands;
+}
+
+/**
+ * Read everything from position 0 through aesd_core_find_entry, following a read cursor
+ */
+static char *core_read_all(struct aesd_core *core)
+{
+    char *result = calloc(core->size + 1, 1);
+    struct aesd_read_cursor cursor = {0};
+    struct aesd_buffer_entry *entry;
+    size_t pos = 0;
+    size_t offset;
+
+    while ((entry = aesd_core_find_entry(core, &cursor, pos, &offset)) != NULL)
+    {
+        memcpy(&result[pos], &entry->buffptr[offset], entry->size - offset);
+        pos += entry->size - offset;
+        aesd_core_update_cursor(core, &cursor, entry, entry->size, pos);
+    }
+    return result;
+}
+
+void test_aesd_core_write_splits_commands()
+{
+    struct aesd_core core;
+    char *content;
+
+    aesd_core_init(&core);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, core_write(&core, "abc\ndef\ngh"), "Two newlines should commit two commands");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(2, core.c_buffer_entry.size, "The bytes after the last newline should stay pending");
+    TEST_ASSERT_EQUAL_INT(0, core_write(&core, "i"));
+    TEST_ASSERT_EQUAL_INT(1, core_write(&core, "\n"));
+    TEST_ASSERT_EQUAL_size_t(0, core.c_buffer_entry.size);
+
+    content = core_read_all(&core);
+    TEST_ASSERT_EQUAL_STRING("abc\ndef\nghi\n", content);
+    free(content);
+    aesd_core_free(&core);
+}
+
+void test_aesd_core_single_command_buffer_is_handed_over()
+{
+    struct aesd_core core;
+    char *write_buf = malloc(4);
+    const char *start = write_buf;
+    struct aesd_buffer_entry command;
+    char *expected = write_buf;
+
+    aesd_core_init(&core);
+    memcpy(write_buf, "abc\n", 4);
+    TEST_ASSERT_EQUAL_INT(1, aesd_core_next_command(&core, &start, expected + 4, &write_buf, &command));
+    TEST_ASSERT_NULL_MESSAGE(write_buf, "A write holding exactly one command should not be copied");
+    TEST_ASSERT_EQUAL_PTR(expected, command.buffptr);
+    aesd_core_commit(&core, &command);
+    aesd_core_free(&core);
+}
+
+void test_aesd_core_eviction_invalidates_cursor()
+{
+    struct aesd_core core;
+    struct aesd_read_cursor cursor = {0};
+    struct aesd_buffer_entry *entry;
+    size_t offset;
+    char line[4];
+    int i;
+
+    aesd_core_init(&core);
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+    {
+        snprintf(line, sizeof(line), "%d\n", i);
+        core_write(&core, line);
+    }
+    entry = aesd_core_find_entry(&core, &cursor, 2, &offset);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING_LEN("1\n", entry->buffptr, 2);
+    aesd_core_update_cursor(&core, &cursor, entry, 2, 4);
+    TEST_ASSERT_EQUAL_UINT64(0, core.out_seq);
+
+    core_write(&core, "x\n");
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(1, core.out_seq, "Evicting the oldest entry should bump the generation");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, core.size, "The evicted bytes should no longer be counted");
+    entry = aesd_core_find_entry(&core, &cursor, 4, &offset);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING_LEN_MESSAGE("3\n", entry->buffptr, 2, "A stale cursor must not be used after an eviction");
+    aesd_core_free(&core);
+}
+
+void test_aesd_core_cmd_to_fpos()
+{
+    struct aesd_core core;
+    size_t pos = 0;
+
+    aesd_core_init(&core);
+    core_write(&core, "write1\nwrite22\nwrite333\n");
+    TEST_ASSERT_EQUAL_INT(0, aesd_core_cmd_to_fpos(&core, 0, 0, &pos));
+    TEST_ASSERT_EQUAL_size_t(0, pos);
+    TEST_ASSERT_EQUAL_INT(0, aesd_core_cmd_to_fpos(&core, 2, 3, &pos));
+    TEST_ASSERT_EQUAL_size_t(7 + 8 + 3, pos);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_core_cmd_to_fpos(&core, 1, 8, &pos), "Offset past the end of the command");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-EINVAL, aesd_core_cmd_to_fpos(&core, 3, 0, &pos), "Command that was never written");
+    aesd_core_free(&core);
+}
+
+void test_aesd_core_byte_budget_eviction()
+{
+    struct aesd_core core;
+    char *content;
+
+    aesd_core_init(&core);
+    aesd_core_set_limits(&core, 3, 10);
+    core_write(&core, "aaa\nbbb\n");
+    TEST_ASSERT_EQUAL_size_t(8, core.size);
+    core_write(&core, "cc\n");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(7, core.size, "The oldest entry should be evicted to stay within 10 bytes");
+    core_write(&core, "d\ne\n");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(7, core.size, "No more than 3 entries should be kept");
+    TEST_ASSERT_EQUAL_UINT64(2, core.out_seq);
+    TEST_ASSERT_EQUAL_UINT64(15, core.head);
+    content = core_read_all(&core);
+    TEST_ASSERT_EQUAL_STRING("cc\nd\ne\n", content);
+    free(content);
+
+    core_write(&core, "0123456789abc\n");
+    TEST_ASSERT_EQUAL_size_t_MESSAGE(14, core.size, "A command over the byte budget should be kept alone");
+    content = core_read_all(&core);
+    TEST_ASSERT_EQUAL_STRING("0123456789abc\n", content);
+    free(content);
+    aesd_core_free(&core);
+}
+
+void test_aesd_core_find_seq()
+{
+    struct aesd_core core;
+    struct aesd_buffer_entry *entry;
+
+    aesd_core_init(&core);
+    aesd_core_set_limits(&core, 2, 0);
+    TEST_ASSERT_NULL_MESSAGE(aesd_core_find_seq(&core, 1), "Nothing is committed yet");
+    core_write(&core, "one\ntwo\nthree\n");
+    TEST_ASSERT_NULL_MESSAGE(aesd_core_find_seq(&core, 1), "Command 1 should be evicted");
+    entry = aesd_core_find_seq(&core, 2);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING_LEN("two\n", entry->buffptr, 4);
+    entry = aesd_core_find_seq(&core, 3);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING_LEN("three\n", entry->buffptr, 6);
+    TEST_ASSERT_NULL(aesd_core_find_seq(&core, 4));
+    aesd_core_free(&core);
+}